@@ -6,6 +6,7 @@
 
 #include <libcurv/geom/compiled_shape.h>
 #include <libcurv/geom/png.h>
+#include <libcurv/geom/video.h>
 #include <libcurv/viewer/viewer.h>
 
 #include <libcurv/context.h>
@@ -24,11 +25,13 @@
 #include <glm/vec2.hpp>
 
 #include <algorithm>
+#include <chrono>
 #include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <memory>
 #include <sstream>
 
 using namespace curv;
@@ -249,7 +252,8 @@ void export_all_png(
         return;
     }
 
-    const char* ipath = ofile.path_.string().c_str();
+    std::string ipath_str = ofile.path_.string();
+    const char* ipath = ipath_str.c_str();
     const char* p = strchr(ipath, '*');
     if (p == nullptr) {
         throw Exception(At_System(shape.system_),
@@ -261,46 +265,82 @@ void export_all_png(
     unsigned count = unsigned(animate / ix.fdur_ + 0.5);
     if (count == 0) count = 1;
     unsigned digs = ndigits(count);
-    double fstart = ix.fstart_;
-    for (unsigned i = 0; i < count; ++i) {
-        ix.fstart_ = fstart + i * ix.fdur_;
+
+    // One renderer is used for the whole sequence. Frame i+1 is rendered
+    // while frame i is read back, and earlier frames are being compressed
+    // and written by the PNG_Writer's threads.
+    geom::check_png_size(ix.size, shape.system_);
+    geom::set_png_compression(ix.png_compression_);
+    geom::Image_Renderer renderer(shape, ix);
+    geom::PNG_Writer writer;
+    auto write_frame = [&](unsigned i) -> void {
+        std::unique_ptr<unsigned char[]> pixels(
+            new unsigned char[size_t(ix.size.x) * ix.size.y * 4]);
+        renderer.finish(pixels.get());
         char num[12];
         snprintf(num, sizeof(num), "%0*d", digs, i);
         auto opath = stringify(prefix, num, suffix);
-        Output_File oofile{shape.system_};
-        oofile.set_path(opath->c_str());
-        geom::export_png(shape, ix, oofile);
-        oofile.commit();
-        //std::cerr << ".";
-        //std::cerr.flush();
+        auto oofile = std::make_unique<Output_File>(shape.system_);
+        oofile->set_path(opath->c_str());
+        writer.write(std::move(oofile), std::move(pixels), ix.size);
+    };
+    auto start_time = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < count; ++i) {
+        renderer.start(ix.fstart_ + i * ix.fdur_);
+        if (i > 0)
+            write_frame(i - 1);
+    }
+    write_frame(count - 1);
+    writer.finish();
+    if (ix.verbose_) {
+        std::chrono::duration<double> export_time =
+            std::chrono::steady_clock::now() - start_time;
+        std::cerr << count << " frames exported in "
+            << export_time.count() << "s\n";
     }
-    //std::cerr << "done\n";
 }
 
-void describe_png_opts(std::ostream& out)
+void describe_image_opts(std::ostream& out)
 {
     out <<
     "-v : verbose output logged to stderr\n"
     "-O xsize=<image width in pixels>\n"
     "-O ysize=<image height in pixels>\n"
-    "-O fstart=<animation frame start time, in seconds> (default 0)\n";
+    "-O fstart=<animation frame start time, in seconds> (default 0)\n"
+    "-O renderer=#gpu|#cpu (default #gpu)\n"
+    "   #cpu renders 2D and 3D shapes on all CPU cores, without an OpenGL\n"
+    "   context. The shape is compiled to native code, so it needs a C++\n"
+    "   compiler at run time, as for -O jit.\n";
     describe_render_opts(out);
+}
+
+void describe_png_opts(std::ostream& out)
+{
+    describe_image_opts(out);
     out <<
-    "-O animate=<duration of animation> (exports an image sequence)\n";
+    "-O animate=<duration of animation> (exports an image sequence)\n"
+    "-O compression=<PNG compression effort, 5 to 64> (default 8)\n"
+    "   Higher values give smaller files, but export more slowly.\n";
 }
 
-void export_png(Value value,
-    Program& prog,
-    const Export_Params& params,
-    Output_File& ofile)
+void describe_y4m_opts(std::ostream& out)
 {
-    geom::Image_Export ix;
+    describe_image_opts(out);
+    out <<
+    "-O animate=<duration of animation> (default: a single frame)\n";
+}
 
+// Options shared by image and video export.
+struct Image_Params
+{
+    geom::Image_Export ix;
     int xsize = 0;
     int ysize = 0;
     double animate = 0.0;
-    for (auto& i : params.map_) {
-        Param p{params, i};
+
+    // Returns false if `p` is not an image export option.
+    bool parse(Param& p)
+    {
         if (parse_render_param(p, ix)) {
             ;
         } else if (p.name_ == "xsize") {
@@ -311,12 +351,29 @@ void export_png(Value value,
             ix.fstart_ = p.to_double();
         } else if (p.name_ == "animate") {
             animate = p.to_double();
+        } else if (p.name_ == "renderer") {
+            auto val = p.to_symbol();
+            if (val == "gpu")
+                ix.cpu_ = false;
+            else if (val == "cpu")
+                ix.cpu_ = true;
+            else
+                throw Exception(p, "'renderer' must be #gpu or #cpu");
         } else {
-            p.unknown_parameter();
+            return false;
         }
+        return true;
     }
 
-    Shape_Program shape(prog);
+    // Recognize the shape, and set the image size.
+    void recognize(Value value, Program& prog, const Export_Params& params,
+        Shape_Program& shape);
+};
+
+void Image_Params::recognize(
+    Value value, Program& prog, const Export_Params& params,
+    Shape_Program& shape)
+{
     At_Program cx(prog);
     if (!shape.recognize(value, &ix))
         throw Exception(cx, "not a shape");
@@ -381,7 +438,47 @@ void export_png(Value value,
             std::cerr << ", " << ix.aa_<<"× temporal antialiasing";
         std::cerr << std::endl;
     }
-    export_all_png(shape, ix, animate, ofile);
+}
+
+void export_png(Value value,
+    Program& prog,
+    const Export_Params& params,
+    Output_File& ofile)
+{
+    Image_Params ip;
+    for (auto& i : params.map_) {
+        Param p{params, i};
+        if (ip.parse(p)) {
+            ;
+        } else if (p.name_ == "compression") {
+            ip.ix.png_compression_ = p.to_int(5, 64);
+        } else {
+            p.unknown_parameter();
+        }
+    }
+
+    Shape_Program shape(prog);
+    ip.recognize(value, prog, params, shape);
+    export_all_png(shape, ip.ix, ip.animate, ofile);
+}
+
+void export_y4m(Value value,
+    Program& prog,
+    const Export_Params& params,
+    Output_File& ofile)
+{
+    Image_Params ip;
+    for (auto& i : params.map_) {
+        Param p{params, i};
+        if (!ip.parse(p))
+            p.unknown_parameter();
+    }
+
+    Shape_Program shape(prog);
+    ip.recognize(value, prog, params, shape);
+    unsigned count = unsigned(ip.animate / ip.ix.fdur_ + 0.5);
+    if (count == 0) count = 1;
+    geom::export_y4m(shape, ip.ix, count, ofile.open_stream());
 }
 
 void describe_no_opts(std::ostream&) {}
@@ -397,6 +494,8 @@ std::map<std::string, Exporter> exporters = {
     {"json", {export_json, "JSON expression", describe_no_opts}},
     {"cpp", {export_cpp, "C++ source file (shape only)", describe_no_opts}},
     {"png", {export_png, "PNG image file (shape only)", describe_png_opts}},
+    {"y4m", {export_y4m, "YUV4MPEG2 video stream (shape only)",
+             describe_y4m_opts}},
 };
 
 void parse_viewer_config(
@@ -133,6 +133,11 @@ extern void export_png(curv::Value value,
     const Export_Params& params,
     curv::Output_File&);
 
+extern void export_y4m(curv::Value value,
+    curv::Program&,
+    const Export_Params& params,
+    curv::Output_File&);
+
 void describe_mesh_opts(std::ostream&);
 void describe_colour_mesh_opts(std::ostream&);
 
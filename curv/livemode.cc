@@ -23,15 +23,23 @@ extern "C" {
 #ifndef _WIN32
     #include <sys/wait.h>
 #endif
+#ifdef __linux__
+    #include <poll.h>
+    #include <sys/inotify.h>
+#endif
 }
+#include <chrono>
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <string_view>
 #include <thread>
 
 #include "shapes.h"
 #include "view_server.h"
 #include <libcurv/context.h>
 #include <libcurv/exception.h>
+#include <libcurv/import.h>
 #include <libcurv/program.h>
 #include <libcurv/source.h>
 #include <libcurv/system.h>
@@ -160,59 +168,233 @@ poll_editor(editor_handle_t editor_handle)
 #endif
 }
 
+// The files read by an evaluation of the main file, with the versions that
+// were read. The main file is reloaded when any of them changes.
+using Watched_Files = std::map<curv::Filesystem::path, curv::File_Stamp>;
+
+// Return true if a watched file has changed since it was read.
+static bool
+files_changed(Watched_Files& files)
+{
+    for (auto& f : files) {
+        if (!curv::file_is_current(f.first, f.second))
+            return true;
+    }
+    return false;
+}
+
+// Return true if a watched file, other than the main file, has changed.
+static bool
+imports_changed(Watched_Files& files, const curv::Filesystem::path& mainfile)
+{
+    for (auto& f : files) {
+        if (f.first == mainfile)
+            continue;
+        if (!curv::file_is_current(f.first, f.second))
+            return true;
+    }
+    return false;
+}
+
+#ifdef __linux__
+// Wait for a watched file to change, using inotify. Directories are watched,
+// rather than files, because many editors save a file by writing a new file
+// and renaming it over the old one.
+//
+// Returns 1 if a file changed, 0 if the editor quit, -1 if inotify is not
+// available.
+static int
+inotify_wait(Watched_Files& files, editor_handle_t* editor_handle)
+{
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    std::map<int, curv::Filesystem::path> dirs;
+    const uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM
+        | IN_CREATE | IN_DELETE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF;
+    for (auto& f : files) {
+        boost::system::error_code ec;
+        // A directory dependency is watched for changes to its entries.
+        auto dir = curv::Filesystem::is_directory(f.first, ec)
+            ? f.first : f.first.parent_path();
+        int wd = inotify_add_watch(fd, dir.c_str(), mask);
+        if (wd < 0) {
+            close(fd);
+            return -1;
+        }
+        dirs[wd] = dir;
+    }
+
+    // Catch changes made between reading the files and adding the watches.
+    if (files_changed(files)) {
+        close(fd);
+        return 1;
+    }
+
+    // Read pending events. Return true if a watched file was affected.
+    auto read_events = [&]() -> bool {
+        bool changed = false;
+        alignas(struct inotify_event) char buf[8192];
+        for (;;) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n <= 0)
+                return changed;
+            for (char* p = buf; p < buf + n; ) {
+                auto ev = (struct inotify_event*)p;
+                p += sizeof(struct inotify_event) + ev->len;
+                if (ev->mask & (IN_Q_OVERFLOW|IN_IGNORED|IN_DELETE_SELF
+                                |IN_MOVE_SELF))
+                {
+                    changed = true;
+                    continue;
+                }
+                auto d = dirs.find(ev->wd);
+                if (d == dirs.end())
+                    continue;
+                if (files.count(d->second)
+                    || (ev->len > 0 && files.count(d->second / ev->name)))
+                {
+                    changed = true;
+                }
+            }
+        }
+    };
+
+    struct pollfd pfd = {fd, POLLIN, 0};
+    for (;;) {
+        // Wake up periodically to check if the editor is still running.
+        int r = poll(&pfd, 1, 500);
+        if (editor_handle && !poll_editor(*editor_handle)) {
+            close(fd);
+            return 0;
+        }
+        if (r > 0 && read_events())
+            break;
+    }
+
+    // Debounce: editors may save a file using a burst of writes and renames.
+    // Wait until there have been no events for 20ms (but no more than 200ms).
+    auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(200);
+    while (std::chrono::steady_clock::now() < deadline
+           && poll(&pfd, 1, 20) > 0)
+    {
+        read_events();
+    }
+    close(fd);
+    return 1;
+}
+#endif
+
+// Wait for one of the watched files to change, or for the editor to quit.
+// Return false if the editor has quit.
+static bool
+wait_for_change(Watched_Files& files, editor_handle_t* editor_handle)
+{
+#ifdef __linux__
+    int r = inotify_wait(files, editor_handle);
+    if (r >= 0)
+        return r == 1;
+#endif
+    // Fallback: poll the modification time and size of each file.
+    for (;;) {
+        usleep(250'000);
+        if (editor_handle && !poll_editor(*editor_handle))
+            return false;
+        if (files_changed(files))
+            return true;
+    }
+}
+
+// Evaluate the program. Display the result in the viewer window if it is
+// a shape, otherwise print it.
+static void
+display_program(
+    curv::System& sys, curv::viewer::Viewer_Config& opts,
+    curv::Shared<const curv::Source> file)
+{
+    curv::Program prog{std::move(file), sys};
+    prog.compile();
+    auto value = prog.eval();
+#ifdef CALC_RAY
+    curv::Traced_GPU_Program gprog{prog};
+    if (gprog.recognize(value, opts)) {
+        print_shape(gprog);
+        live_view_server.display_shape(std::move(gprog.vshape_), std::move(gprog.tshape_));
+    } else {
+        std::cout << value << "\n";
+    }
+#else
+    curv::GPU_Program gprog{prog};
+    if (gprog.recognize(value, opts)) {
+        print_shape(gprog);
+        live_view_server.display_shape(std::move(gprog.vshape_));
+    } else {
+        std::cout << value << "\n";
+    }
+#endif
+}
+
 void
 poll_file(
     curv::System* sys, curv::viewer::Viewer_Config* opts,
     editor_handle_t *editor_handle, const char* filename)
 {
+    namespace fs = curv::Filesystem;
+    Watched_Files files;
+    std::size_t source_hash = 0;
     for (;;) {
+        boost::system::error_code ec;
+        auto mainfile = fs::absolute(filename);
+        // If the file is missing, the stamp is File_Stamp{}, and
+        // files_changed() reports no change until it reappears.
+        auto stamp = curv::get_file_stamp(mainfile, ec);
+
         struct stat st;
         if (stat(filename, &st) != 0) {
-            // file doesn't exist.
-            memset((void*)&st, 0, sizeof(st));
+            files.clear();
+            files[mainfile] = stamp;
+            source_hash = 0;
         } else {
-            // evaluate file.
+            // Collect the files imported by the program while evaluating it.
+            Watched_Files newfiles;
+            newfiles[mainfile] = stamp;
+            auto deps = curv::make<curv::Import_Deps>();
+            bool unchanged = false;
             try {
                 auto file = curv::make<curv::File_Source>(
                     curv::make_string(filename), curv::At_System{*sys});
-                curv::Program prog{std::move(file), *sys};
-                prog.compile();
-                auto value = prog.eval();
-#ifdef CALC_RAY
-                curv::Traced_GPU_Program gprog{prog};
-                if (gprog.recognize(value, *opts)) {
-                    print_shape(gprog);
-                    live_view_server.display_shape(std::move(gprog.vshape_), std::move(gprog.tshape_));
-                } else {
-                    std::cout << value << "\n";
-                }
-#else
-                curv::GPU_Program gprog{prog};
-                if (gprog.recognize(value, *opts)) {
-                    print_shape(gprog);
-                    live_view_server.display_shape(std::move(gprog.vshape_));
+
+                // Editors often save a file without changing it. If the text
+                // and the imported files are unchanged, so is the result.
+                // (Unchanged imports are not re-evaluated: see
+                // System::import_cache_.)
+                auto hash = std::hash<std::string_view>{}(
+                    std::string_view(file->begin(), file->size()));
+                unchanged =
+                    hash == source_hash && !imports_changed(files, mainfile);
+                if (unchanged) {
+                    files[mainfile] = stamp;
                 } else {
-                    std::cout << value << "\n";
+                    source_hash = hash;
+                    curv::Current_Import_Deps cdeps(*sys, deps);
+                    display_program(*sys, *opts, std::move(file));
                 }
-#endif
             } catch (std::exception& e) {
                 sys->error(e);
             }
-        }
-        // Wait for file to change or editor to quit.
-        for (;;) {
-            usleep(500'000);
-            if (editor_handle && !poll_editor(*editor_handle)) {
-                // We actually started an editor, but it got now closed as signalled by poll_editor
-                // => also exit Curv's livemode
-                live_view_server.exit();
-                return;
+            if (!unchanged) {
+                curv::collect_import_deps(*sys, *deps, newfiles);
+                files = std::move(newfiles);
             }
-            struct stat st2;
-            if (stat(filename, &st2) != 0)
-                memset((void*)&st2, 0, sizeof(st));
-            if (st.st_mtime != st2.st_mtime)
-                break;
+        }
+
+        // Wait for a file to change or editor to quit.
+        if (!wait_for_change(files, editor_handle)) {
+            // We actually started an editor, but it got now closed as signalled by poll_editor
+            // => also exit Curv's livemode
+            live_view_server.exit();
+            return;
         }
     }
 }
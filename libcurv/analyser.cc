@@ -777,6 +777,15 @@ Assignment_Phrase::analyse(Environ& env, Interp terp) const
 {
     auto lvar = analyse_locative(left_, env, terp);
     auto expr = analyse_op(*right_, env);
+    if (auto loc = cast<Local_Locative>(lvar)) {
+        if (auto cat = cast<Cat_Expr>(expr)) {
+            auto ref = cast<Local_Data_Ref>(cat->arg1_);
+            if (ref && ref->slot_ == loc->slot_) {
+                return make<Append_Local_Action>(share(*this), lvar, expr,
+                    loc->slot_, cat->arg2_);
+            }
+        }
+    }
     return make<Assignment_Action>(share(*this), lvar, expr);
 }
 
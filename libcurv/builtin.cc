@@ -42,6 +42,12 @@ Builtin_Value::to_meaning(const Identifier& id) const
     return make<Constant>(share(id), value_);
 }
 
+Shared<Meaning>
+Builtin_Module_Field::to_meaning(const Identifier& id) const
+{
+    return make<Constant>(share(id), module_->get(slot_));
+}
+
 //----------------------------------------------//
 // Templates for constructing builtin functions //
 //----------------------------------------------//
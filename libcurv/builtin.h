@@ -8,6 +8,7 @@
 #include <memory>
 #include <libcurv/symbol.h>
 #include <libcurv/function.h>
+#include <libcurv/module.h>
 #include <libcurv/value.h>
 
 namespace curv {
@@ -27,6 +28,19 @@ struct Builtin_Value : public Builtin
     virtual Shared<Meaning> to_meaning(const Identifier&) const override;
 };
 
+// A field of a library module, such as std.curv. The field is not evaluated
+// until it is referenced by a program (see Thunk).
+struct Builtin_Module_Field : public Builtin
+{
+    Shared<const Module> module_;
+    slot_t slot_;
+    Builtin_Module_Field(Shared<const Module> m, slot_t slot)
+    :
+        module_(std::move(m)), slot_(slot)
+    {}
+    virtual Shared<Meaning> to_meaning(const Identifier&) const override;
+};
+
 template <class M>
 struct Builtin_Meaning : public Builtin
 {
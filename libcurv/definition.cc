@@ -250,6 +250,21 @@ Recursive_Scope::analyse()
         for (auto b : dictionary_)
             (*d)[b.first] = b.second.slot_index_;
         executable_.module_dictionary_ = d;
+
+        // A module at the top level of a source file is evaluated lazily.
+        // Its setters only reference module slots and local temporaries
+        // (not enclosing local variables or nonlocals), so each setter can
+        // run later in a fresh frame. Test definitions bind no fields, so they
+        // are executed eagerly. See Thunk.
+        if (parent_->parent_ == nullptr) {
+            executable_.field_actions_.resize(dictionary_.size());
+            for (auto b : dictionary_) {
+                auto& unit = units_[b.second.unit_index_];
+                assert(unit.action_ >= 0);
+                executable_.field_actions_[b.second.slot_index_] = unit.action_;
+            }
+            executable_.lazy_nslots_ = frame_maxslots_;
+        }
     }
 }
 
@@ -320,6 +335,7 @@ Recursive_Scope::analyse_unit(Unit& unit, const Identifier* id)
             assert(scc_stack_.back() == &unit);
             scc_stack_.pop_back();
             unit.state_ = Unit::k_analysed;
+            unit.action_ = executable_.actions_.size();
             executable_.actions_.push_back(
                 unit.def_->make_setter(executable_.module_slot_));
         } else {
@@ -340,6 +356,7 @@ Recursive_Scope::analyse_unit(Unit& unit, const Identifier* id)
                 scc_stack_.pop_back();
                 assert(u->scc_lowlink_ == unit.scc_ord_);
                 u->state_ = Unit::k_analysed;
+                u->action_ = executable_.actions_.size() - 1;
             } while (u != &unit);
         }
     }
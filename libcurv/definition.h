@@ -205,6 +205,7 @@ struct Recursive_Scope : public Scope
         int scc_ord_ = -1; // -1 until SCC assigned
         int scc_lowlink_ = -1;
         Symbol_Map<Shared<Operation>> nonlocals_ = {};
+        int action_ = -1; // index of setter in executable_.actions_
 
         Unit(Shared<Unitary_Definition> def) : def_(def) {}
 
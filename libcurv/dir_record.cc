@@ -30,7 +30,8 @@ Dir_Record::Dir_Record(Filesystem::path dir, const Context& cx)
 :
     Record(Ref_Value::sty_dir_record),
     dir_(dir),
-    fields_{}
+    fields_{},
+    import_deps_(cx.system().import_deps_)
 {
     namespace fs = boost::filesystem;
     System& sys(cx.system());
@@ -68,14 +69,23 @@ Dir_Record::Dir_Record(Filesystem::path dir, const Context& cx)
     }
 }
 
-Dir_Record::Dir_Record(Filesystem::path dir, Symbol_Map<File> fields)
+Dir_Record::Dir_Record(
+    Filesystem::path dir, Symbol_Map<File> fields, Shared<Import_Deps> deps)
 :
     Record(Ref_Value::sty_dir_record),
     dir_(dir),
-    fields_(fields)
+    fields_(fields),
+    import_deps_(deps)
 {
 }
 
+Value Dir_Record::import_file(const File& file, const Context& cx) const
+{
+    Current_Import_Deps cdeps(cx.system(), import_deps_);
+    depend_on_file(file.path_, cx);
+    return file.importer_(file.path_, cx);
+}
+
 void Dir_Record::print_repr(std::ostream& out) const
 {
     out << "{";
@@ -94,7 +104,7 @@ Value Dir_Record::find_field(Symbol_Ref sym, const Context& cx) const
     if (p == fields_.end())
         return missing;
     if (p->second.value_.is_missing())
-        p->second.value_ = p->second.importer_(p->second.path_, cx);
+        p->second.value_ = import_file(p->second, cx);
     return p->second.value_;
 }
 
@@ -111,7 +121,7 @@ size_t Dir_Record::size() const
 Shared<Record>
 Dir_Record::clone() const
 {
-    return make<Dir_Record>(dir_, fields_);
+    return make<Dir_Record>(dir_, fields_, import_deps_);
 }
 
 Value*
@@ -124,7 +134,7 @@ Dir_Record::ref_field(Symbol_Ref name, bool need_value, const Context& cx)
     }
     if (p->second.value_.is_missing()) {
         if (need_value)
-            p->second.value_ = p->second.importer_(p->second.path_, cx);
+            p->second.value_ = import_file(p->second, cx);
     }
     return &p->second.value_;
 }
@@ -153,7 +163,7 @@ void Dir_Record::Iter::load_value(const Context& cx)
 {
     if (i_ != rec_.fields_.end()) {
         if (i_->second.value_.is_missing())
-            i_->second.value_ = i_->second.importer_(i_->second.path_, cx);
+            i_->second.value_ = rec_.import_file(i_->second, cx);
         value_ = i_->second.value_;
     }
 }
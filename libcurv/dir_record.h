@@ -22,9 +22,15 @@ struct Dir_Record : public Record
         mutable Value value_;
     };
     Symbol_Map<File> fields_;
+    // Files are imported on first reference. If this directory was imported
+    // while importing a Curv file, those files are dependencies of that file.
+    Shared<Import_Deps> import_deps_;
 
     Dir_Record(Filesystem::path dir, const Context&);
-    Dir_Record(Filesystem::path dir, Symbol_Map<File> fields);
+    Dir_Record(Filesystem::path dir, Symbol_Map<File> fields,
+        Shared<Import_Deps> deps);
+
+    Value import_file(const File&, const Context&) const;
 
     virtual void print_repr(std::ostream&) const override;
     virtual Value find_field(Symbol_Ref, const Context&) const override;
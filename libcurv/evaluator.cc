@@ -11,6 +11,7 @@
 #include <libcurv/module.h>
 #include <libcurv/parametric.h>
 #include <libcurv/prim.h>
+#include <libcurv/prim_expr.h>
 #include <libcurv/record.h>
 #include <libcurv/sc_compiler.h>
 #include <libcurv/string.h>
@@ -108,7 +109,7 @@ Module_Data_Ref::eval(Frame& f) const
 {
     Module& m = (Module&)f[slot_].to_ref_unsafe();
     assert(m.subtype_ == Ref_Value::sty_module);
-    return m.at(index_);
+    return m.get(index_);
 }
 
 Value
@@ -478,8 +479,26 @@ Scope_Executable::eval_module(Frame& f) const
         Module::make(module_dictionary_->size(), module_dictionary_);
     f[module_slot_] = {module};
     Operation::Action_Executor aex;
-    for (auto action : actions_)
-        action->exec(f, aex);
+    if (field_actions_.empty()) {
+        for (auto action : actions_)
+            action->exec(f, aex);
+    } else {
+        // Lazy module: store a Thunk for each setter into the slots it
+        // initializes. Actions that don't initialize a field are executed now.
+        std::vector<Value> thunks(actions_.size());
+        for (slot_t i = 0; i < field_actions_.size(); ++i) {
+            Value& th = thunks[field_actions_[i]];
+            if (th.is_missing()) {
+                th = {make<Thunk>(actions_[field_actions_[i]], f.system_,
+                    module_slot_, lazy_nslots_)};
+            }
+            module->at(i) = th;
+        }
+        for (size_t a = 0; a < actions_.size(); ++a) {
+            if (thunks[a].is_missing())
+                actions_[a]->exec(f, aex);
+        }
+    }
     return module;
 }
 void
@@ -598,6 +617,37 @@ Assignment_Action::exec(Frame& f, Executor&) const
     locative_->store(f, *expr_);
 }
 
+void
+Append_Local_Action::exec(Frame& f, Executor&) const
+{
+    // Same evaluation order as Cat_Expr: the variable is read before
+    // the tail is evaluated.
+    Value base = f[slot_];
+    Value tail = tail_->eval(f);
+    // Drop the variable's reference, so that 'base' may become unique.
+    f[slot_] = missing;
+    if (auto list = base.maybe<List>()) {
+        auto alist = tail.maybe<Abstract_List>();
+        if (alist && !list->empty()) {
+            // A non-empty List contains a non-character, so the result is
+            // still a canonical List, whatever elements we append.
+            base = missing;
+            List_Base::append(list, *alist);
+            f[slot_] = {list};
+            return;
+        }
+    } else if (auto str = base.maybe<String>()) {
+        if (auto tstr = tail.maybe<String>()) {
+            base = missing;
+            String_Base::append(str, tstr->data(), tstr->size());
+            f[slot_] = {str};
+            return;
+        }
+    }
+    f[slot_] = Cat_Op::call(Fail::hard, At_Phrase(*expr_->syntax_, f),
+        std::move(base), std::move(tail));
+}
+
 Value
 Module_Expr::eval(Frame& f) const
 {
@@ -40,6 +40,9 @@ void export_frag_2d(
             << opts.bg_.z << ");\n"
         "#ifdef GLSLVIEWER\n"
         "uniform mat3 u_view2d;\n"
+        "uniform int u_aa;\n"
+        "uniform vec2 u_jitter;\n"
+        "uniform bool u_linear;\n"
         "#ifdef MULTIPASS_RENDER\n"
         "uniform sampler2D fp;\n"
         "in vec2 v_texcoord;\n"
@@ -75,10 +78,19 @@ void export_frag_2d(
         "        offset.x -= (iResolution.x*scale - size.x)/2.0;\n"
         "    }\n"
         "    vec3 col = vec3(0.0);\n"
+        "#if AA>1 && defined(GLSLVIEWER)\n"
+        "    // The viewer lowers the AA factor while the view is moving,\n"
+        "    // and renders one jittered sample per frame when it is static.\n"
+        "    int aa = u_aa > 0 ? min(u_aa, AA) : AA;\n"
+        "    vec2 aa_offset = u_jitter - 0.5;\n"
+        "#else\n"
+        "    const int aa = AA;\n"
+        "    const vec2 aa_offset = vec2(-0.5);\n"
+        "#endif\n"
         "#if AA>1\n"
-        "  for (int m=0; m<AA; ++m)\n"
-        "  for (int n=0; n<AA; ++n) {\n"
-        "    vec2 jitter = vec2(float(m),float(n)) / float(AA) - 0.5;\n"
+        "  for (int m=0; m<aa; ++m)\n"
+        "  for (int n=0; n<aa; ++n) {\n"
+        "    vec2 jitter = vec2(float(m),float(n)) / float(aa) + aa_offset;\n"
         "#else\n"
         "    const vec2 jitter = vec2(0.0);\n"
         "#endif\n"
@@ -107,9 +119,13 @@ void export_frag_2d(
         "  }\n"
         "#endif\n"
         "#if AA>1 || TAA>1\n"
-        "    col /= float(AA*AA*TAA);\n"
+        "    col /= float(aa*aa*TAA);\n"
         "#endif\n"
        "    // convert linear RGB to sRGB\n"
+       "#ifdef GLSLVIEWER\n"
+       "    // (unless the viewer is accumulating samples, see u_jitter)\n"
+       "    if (!u_linear)\n"
+       "#endif\n"
        "    col = pow(col, vec3(0.454545454545454545));\n"
        "#if defined(GLSLVIEWER) && defined(MULTIPASS_RENDER)\n"
        "    vec4 fpColour = texture(fp, v_texcoord);\n"
@@ -148,6 +164,9 @@ void export_frag_3d(
         "const int ray_max_iter = " << opts.ray_max_iter_ << ";\n"
         "const float ray_max_depth = " << dfmt(opts.ray_max_depth_, dfmt::EXPR) << ";\n"
         "#ifdef GLSLVIEWER\n"
+        "uniform int u_aa;\n"
+        "uniform vec2 u_jitter;\n"
+        "uniform bool u_linear;\n"
         "uniform vec3 u_eye3d;\n"
         "uniform vec3 u_centre3d;\n"
         "uniform vec3 u_up3d;\n"
@@ -175,7 +194,20 @@ void export_frag_3d(
             << dfmt(bbox.xmax, dfmt::EXPR) << ","
             << dfmt(bbox.ymax, dfmt::EXPR) << ","
             << dfmt(bbox.zmax, dfmt::EXPR)
-            << ");\n";
+            << ");\n"
+        // A finite bounding box is used to clip rays in castRay.
+        << "#define BBOX_CLIP\n";
+    }
+
+    bool heatmap = opts.shader_ == Render_Opts::Shader::heatmap;
+    bool relax = opts.ray_relax_ > 1.0;
+    double precision =
+        opts.ray_precision_ > 0.0 ? opts.ray_precision_ : 0.0005;
+
+    if (heatmap) {
+        out <<
+        "// number of dist evaluations in the last call to castRay\n"
+        "int ray_steps = 0;\n";
     }
 
     // Following code is based on code fragments written by Inigo Quilez,
@@ -191,28 +223,68 @@ void export_frag_3d(
        "{\n"
        "    float tmin = 0.0;\n" // was 1.0
        "    float tmax = ray_max_depth;\n"
-       "   \n"
-       // TODO: implement bounding volume. If I remove the 'if(t>tmax)break'
-       // check, then `tetrahedron` breaks. The hard coded tmax=200 fails for
-       // some models.
-       //"#if 0\n"
-       //"    // bounding volume\n"
-       //"    float tp1 = (0.0-ro.y)/rd.y; if( tp1>0.0 ) tmax = min( tmax, tp1 );\n"
-       //"    float tp2 = (1.6-ro.y)/rd.y; if( tp2>0.0 ) { if( ro.y>1.6 ) tmin = max( tmin, tp2 );\n"
-       //"                                                 else           tmax = min( tmax, tp2 ); }\n"
-       //"#endif\n"
-       //"    \n"
-       "    float t = tmin;\n"
        "    vec3 c = vec3(-1.0,-1.0,-1.0);\n"
+       "   \n"
+       // Clip the ray to the bounding box (slab method), so that we don't
+       // march through empty space in front of or behind the shape.
+       // The box is padded a little, so that surfaces lying on the box
+       // faces are still hit.
+       "#ifdef BBOX_CLIP\n"
+       "    vec3 pad = (bbox_max - bbox_min)*0.001 + 0.001;\n"
+       "    vec3 rinv = 1.0/rd;\n"
+       "    vec3 t0 = (bbox_min - pad - ro)*rinv;\n"
+       "    vec3 t1 = (bbox_max + pad - ro)*rinv;\n"
+       "    vec3 tlo = min(t0,t1);\n"
+       "    vec3 thi = max(t0,t1);\n"
+       "    tmin = max(tmin, max(tlo.x, max(tlo.y, tlo.z)));\n"
+       "    tmax = min(tmax, min(thi.x, min(thi.y, thi.z)));\n"
+       "    if (tmin > tmax) return vec4( ray_max_depth, c );\n"
+       "#endif\n"
+       "    float t = tmin;\n";
+    if (heatmap) out <<
+       "    ray_steps = 0;\n";
+    if (relax) out <<
+       "    float omega = " << dfmt(opts.ray_relax_, dfmt::EXPR) << ";\n"
+       "    float prev_d = 0.0;\n"
+       "    float stride = 0.0;\n";
+    out <<
        "    for (int i=0; i<ray_max_iter; i++) {\n"
-       "        float precis = 0.0005*t;\n"
+       ;
+    if (opts.ray_precision_ == Render_Opts::pixel_precision) out <<
+       // Half the width of an AA sample, which spans 2/(iResolution.y*AA)
+       // in screen coordinates, at a lens length of 2.5.
+       "        float precis = t/(iResolution.y*"
+            << dfmt(2.5 * opts.aa_, dfmt::EXPR) << ");\n";
+    else out <<
+       "        float precis = " << dfmt(precision, dfmt::EXPR) << "*t;\n";
+    out <<
        "        vec4 p = vec4(ro+rd*t,time);\n"
-       "        float d = dist(p);\n"
+       "        float d = dist(p);\n";
+    if (heatmap) out <<
+       "        ++ray_steps;\n";
+    if (relax) out <<
+       // Over-relaxed sphere tracing (Keinert et al, 2014): step by omega*d.
+       // If the unbounding spheres of the last two points don't overlap,
+       // we may have stepped over a surface, so step back to the last safe
+       // point, and continue with plain sphere tracing.
+       "        if (omega > 1.0 && abs(d) + prev_d < stride) {\n"
+       "            t += prev_d - stride;\n"
+       "            stride = prev_d;\n"
+       "            omega = 1.0;\n"
+       "            continue;\n"
+       "        }\n";
+    out <<
        "        if (d < precis) {\n"
        "            c = colour(p);\n"
        "            break;\n"
-       "        }\n"
-       "        t += d;\n"
+       "        }\n";
+    if (relax) out <<
+       "        prev_d = d;\n"
+       "        stride = d*omega;\n"
+       "        t += stride;\n";
+    else out <<
+       "        t += d;\n";
+    out <<
        "        if (t > tmax) break;\n"
        "    }\n"
        "    return vec4( t, c );\n"
@@ -436,6 +508,22 @@ void export_frag_3d(
        "}\n";
     }
 
+    if (heatmap) {
+       out <<
+       // A debug shader for tuning the ray marcher: the colour shows the
+       // number of ray-march steps on a log scale, from blue (1 step)
+       // through green to red (1024 or more steps). Rays that miss the
+       // shape are drawn darker.
+       "vec3 render( in vec3 ro, in vec3 rd, float time )\n"
+       "{\n"
+       "    vec4 res = castRay(ro, rd, time);\n"
+       "    float h = clamp(log2(float(ray_steps) + 1.0) / 10.0, 0.0, 1.0);\n"
+       "    vec3 col = clamp(vec3(2.0*h - 1.0, 1.0 - abs(2.0*h - 1.0), 1.0 - 2.0*h), 0.0, 1.0);\n"
+       "    if (res.y < 0.0) col *= 0.5;\n"
+       "    return col;\n"
+       "}\n";
+    }
+
     out <<
        "// Create a matrix to transform coordinates to look towards a given point.\n"
        "// * `eye` is the position of the camera.\n"
@@ -464,10 +552,19 @@ void export_frag_3d(
        "    const vec3 origin = (bbox_min + bbox_max) / 2.0;\n"
        "    const vec3 radius = (bbox_max - bbox_min) / 2.0;\n"
        "    float r = max(radius.x, max(radius.y, radius.z)) / 1.3;\n"
+       "#if AA>1 && defined(GLSLVIEWER)\n"
+       "    // The viewer lowers the AA factor while the view is moving,\n"
+       "    // and renders one jittered sample per frame when it is static.\n"
+       "    int aa = u_aa > 0 ? min(u_aa, AA) : AA;\n"
+       "    vec2 aa_offset = u_jitter - 0.5;\n"
+       "#else\n"
+       "    const int aa = AA;\n"
+       "    const vec2 aa_offset = vec2(-0.5);\n"
+       "#endif\n"
        "#if AA>1\n"
-       "  for (int m=0; m<AA; ++m)\n"
-       "  for (int n=0; n<AA; ++n) {\n"
-       "    vec2 o = vec2(float(m),float(n)) / float(AA) - 0.5;\n"
+       "  for (int m=0; m<aa; ++m)\n"
+       "  for (int n=0; n<aa; ++n) {\n"
+       "    vec2 o = vec2(float(m),float(n)) / float(aa) + aa_offset;\n"
        "#else\n"
        "    const vec2 o = vec2(0.0);\n"
        "#endif\n"
@@ -502,10 +599,14 @@ void export_frag_3d(
        "  }\n"
        "#endif\n"
        "#if AA>1 || TAA>1\n"
-       "    col /= float(AA*AA*TAA);\n"
+       "    col /= float(aa*aa*TAA);\n"
        "#endif\n"
        "\n"
        "    // convert linear RGB to sRGB\n"
+       "#ifdef GLSLVIEWER\n"
+       "    // (unless the viewer is accumulating samples, see u_jitter)\n"
+       "    if (!u_linear)\n"
+       "#endif\n"
        "    col = pow(col, vec3(0.454545454545454545));\n"
        "#if defined(GLSLVIEWER) && defined(MULTIPASS_RENDER)\n"
        "    vec4 fpColour = texture(fp, v_texcoord);\n"
@@ -10,7 +10,7 @@
 
 namespace curv { namespace geom {
 
-Compiled_Shape::Compiled_Shape(Shape_Program& rshape)
+Compiled_Shape::Compiled_Shape(const Shape_Program& rshape)
 :
     cpp_{rshape.system_}
 {
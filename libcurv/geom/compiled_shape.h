@@ -24,7 +24,7 @@ struct Compiled_Shape final : public Shape
     Cpp_Dist_Func dist_;
     Cpp_Colour_Func colour_;
 
-    Compiled_Shape(Shape_Program&);
+    Compiled_Shape(const Shape_Program&);
 
     virtual double dist(double x, double y, double z, double t) override
     {
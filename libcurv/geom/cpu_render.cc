@@ -0,0 +1,306 @@
+// Copyright 2016-2020 Doug Moen
+// Licensed under the Apache License, version 2.0
+// See accompanying file LICENSE or https://www.apache.org/licenses/LICENSE-2.0
+
+#include <libcurv/geom/cpu_render.h>
+
+#include <libcurv/geom/compiled_shape.h>
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+namespace curv { namespace geom {
+
+namespace {
+
+using glm::vec2;
+using glm::vec3;
+using glm::vec4;
+
+// A C++ translation of the GLSL code generated by frag.cc.
+// Single precision is used throughout, to match the GPU.
+struct CPU_Renderer
+{
+    Compiled_Shape& shape_;
+    const Image_Export& ix_;
+    vec3 bg_;
+    vec2 res_;
+
+    // 2D: mapping from pixel coordinates to shape coordinates.
+    float scale_;
+    vec2 offset_;
+
+    // 3D: the default camera of the Viewer (see Viewer::reset_view).
+    vec3 eye_;
+    glm::mat3 camera_;
+    // Rays are clipped to the bounding box, if it is finite.
+    bool clip_ = false;
+    vec3 clip_min_, clip_max_;
+    float precision_;
+
+    CPU_Renderer(Compiled_Shape& shape, const Image_Export& ix)
+    :
+        shape_(shape),
+        ix_(ix),
+        bg_(ix.bg_),
+        res_(ix.size),
+        precision_(
+            ix.ray_precision_ > 0.0 ? float(ix.ray_precision_)
+            // Half the width of an AA sample, as in export_frag_3d.
+            : ix.ray_precision_ == Render_Opts::pixel_precision
+            ? 1.0f / (float(ix.size.y) * 2.5f * float(ix.aa_))
+            : 0.0005f)
+    {
+        BBox bbox = shape.bbox_;
+        if (shape.is_2d_) {
+            vec4 bb(-10.0f, -10.0f, +10.0f, +10.0f);
+            if (!bbox.empty2() && !bbox.infinite2())
+                bb = vec4(bbox.xmin, bbox.ymin, bbox.xmax, bbox.ymax);
+            vec2 size = vec2(bb.z, bb.w) - vec2(bb.x, bb.y);
+            vec2 scale2 = size / res_;
+            offset_ = vec2(bb.x, bb.y);
+            if (scale2.x > scale2.y) {
+                scale_ = scale2.x;
+                offset_.y -= (res_.y*scale_ - size.y)/2.0f;
+            } else {
+                scale_ = scale2.y;
+                offset_.x -= (res_.x*scale_ - size.x)/2.0f;
+            }
+        } else {
+            vec3 bbox_min(-10.0f), bbox_max(+10.0f);
+            if (!bbox.empty3() && !bbox.infinite3()) {
+                bbox_min = vec3(bbox.xmin, bbox.ymin, bbox.zmin);
+                bbox_max = vec3(bbox.xmax, bbox.ymax, bbox.zmax);
+                vec3 pad = (bbox_max - bbox_min)*0.001f + 0.001f;
+                clip_ = true;
+                clip_min_ = bbox_min - pad;
+                clip_max_ = bbox_max + pad;
+            }
+            vec3 origin = (bbox_min + bbox_max) / 2.0f;
+            vec3 radius = (bbox_max - bbox_min) / 2.0f;
+            float r = std::max(radius.x, std::max(radius.y, radius.z)) / 1.3f;
+            // Convert from the OpenGL coordinate system to the Curv
+            // coordinate system.
+            vec3 eye3d(2.598076f, 3.0f, 4.5f);
+            vec3 up3d(-0.25f, 0.866025f, -0.433013f);
+            eye_ = vec3(eye3d.x, -eye3d.z, eye3d.y)*r + origin;
+            vec3 centre = origin;
+            vec3 up = vec3(up3d.x, -up3d.z, up3d.y);
+            vec3 ww = glm::normalize(centre - eye_);
+            vec3 uu = glm::normalize(glm::cross(ww, up));
+            vec3 vv = glm::normalize(glm::cross(uu, ww));
+            camera_ = glm::mat3(uu, vv, ww);
+        }
+    }
+
+    float dist(vec4 p)
+    {
+        float d;
+        shape_.dist_(&p, &d);
+        return d;
+    }
+    vec3 colour(vec4 p)
+    {
+        vec3 c;
+        shape_.colour_(&p, &c);
+        return c;
+    }
+
+    vec4 cast_ray(vec3 ro, vec3 rd, float time)
+    {
+        float tmin = 0.0f;
+        float tmax = float(ix_.ray_max_depth_);
+        vec3 c(-1.0f);
+        if (clip_) {
+            vec3 rinv = 1.0f / rd;
+            vec3 t0 = (clip_min_ - ro)*rinv;
+            vec3 t1 = (clip_max_ - ro)*rinv;
+            vec3 tlo = glm::min(t0, t1);
+            vec3 thi = glm::max(t0, t1);
+            tmin = std::max(tmin, std::max(tlo.x, std::max(tlo.y, tlo.z)));
+            tmax = std::min(tmax, std::min(thi.x, std::min(thi.y, thi.z)));
+            if (tmin > tmax)
+                return vec4(float(ix_.ray_max_depth_), c);
+        }
+        float t = tmin;
+        float omega = float(ix_.ray_relax_);
+        float prev_d = 0.0f;
+        float stride = 0.0f;
+        for (int i = 0; i < ix_.ray_max_iter_; ++i) {
+            float precis = precision_*t;
+            vec4 p(ro + rd*t, time);
+            float d = dist(p);
+            if (omega > 1.0f && std::abs(d) + prev_d < stride) {
+                // over-relaxation failed, see frag.cc
+                t += prev_d - stride;
+                stride = prev_d;
+                omega = 1.0f;
+                continue;
+            }
+            if (d < precis) {
+                c = colour(p);
+                break;
+            }
+            prev_d = d;
+            stride = d*omega;
+            t += stride;
+            if (t > tmax) break;
+        }
+        return vec4(t, c);
+    }
+
+    vec3 calc_normal(vec3 pos, float time)
+    {
+        const float e = 0.5773f*0.0005f;
+        const vec3 xyy(e,-e,-e), yyx(-e,-e,e), yxy(-e,e,-e), xxx(e,e,e);
+        return glm::normalize(
+            xyy*dist(vec4(pos + xyy, time)) +
+            yyx*dist(vec4(pos + yyx, time)) +
+            yxy*dist(vec4(pos + yxy, time)) +
+            xxx*dist(vec4(pos + xxx, time)));
+    }
+
+    float calc_ao(vec3 pos, vec3 nor, float time)
+    {
+        float occ = 0.0f;
+        float sca = 1.0f;
+        for (int i = 0; i < 5; ++i) {
+            float hr = 0.01f + 0.12f*float(i)/4.0f;
+            vec3 aopos = nor*hr + pos;
+            float dd = dist(vec4(aopos, time));
+            occ += -(dd-hr)*sca;
+            sca *= 0.95f;
+        }
+        return glm::clamp(1.0f - 3.0f*occ, 0.0f, 1.0f);
+    }
+
+    vec3 render(vec3 ro, vec3 rd, float time)
+    {
+        vec3 col = bg_;
+        vec4 res = cast_ray(ro, rd, time);
+        float t = res.x;
+        vec3 c(res.y, res.z, res.w);
+        if (c.x >= 0.0f) {
+            vec3 pos = ro + t*rd;
+            vec3 nor = calc_normal(pos, time);
+            vec3 ref = glm::reflect(rd, nor);
+
+            // material
+            col = c;
+
+            // lighting
+            float occ = calc_ao(pos, nor, time);
+            vec3  lig = glm::normalize(vec3(-0.4f, 0.6f, 0.7f));
+            float amb = glm::clamp(0.5f+0.5f*nor.z, 0.0f, 1.0f);
+            float dif = glm::clamp(glm::dot(nor, lig), 0.0f, 1.0f);
+            float bac = glm::clamp(glm::dot(nor,
+                    glm::normalize(vec3(-lig.x, lig.y, 0.0f))), 0.0f, 1.0f)
+                * glm::clamp(1.0f-pos.z, 0.0f, 1.0f);
+            float dom = glm::smoothstep(-0.1f, 0.1f, ref.z);
+            float fre = std::pow(
+                glm::clamp(1.0f+glm::dot(nor,rd), 0.0f, 1.0f), 2.0f);
+            float spe = std::pow(
+                glm::clamp(glm::dot(ref,lig), 0.0f, 1.0f), 16.0f);
+
+            vec3 lin(0.0f);
+            lin += 1.30f*dif*vec3(1.00f,0.80f,0.55f);
+            lin += 2.00f*spe*vec3(1.00f,0.90f,0.70f)*dif;
+            lin += 0.40f*amb*vec3(0.40f,0.60f,1.00f)*occ;
+            lin += 0.50f*dom*vec3(0.40f,0.60f,1.00f)*occ;
+            lin += 0.50f*bac*vec3(0.35f,0.35f,0.35f)*occ;
+            lin += 0.25f*fre*vec3(1.00f,1.00f,1.00f)*occ;
+            vec3 iqcol = col*lin;
+
+            col = glm::mix(col, iqcol, 0.5f); // adjust contrast
+        }
+        return glm::clamp(col, 0.0f, 1.0f);
+    }
+
+    // Compute the linear RGB colour of a sample at position `xy`,
+    // in pixel coordinates.
+    vec3 sample(vec2 xy, float time)
+    {
+        if (shape_.is_2d_) {
+            vec4 p(xy*scale_ + offset_, 0.0f, time);
+            return dist(p) > 0.0f ? bg_ : colour(p);
+        }
+        vec2 p = -1.0f + 2.0f * xy / res_;
+        p.x *= res_.x/res_.y;
+        vec3 dir = glm::normalize(camera_ * vec3(p, 2.5f));
+        return render(eye_, dir, time);
+    }
+
+    // The same antialiasing and colour conversion as mainImage.
+    vec3 pixel(vec2 frag_coord, float time)
+    {
+        int aa = ix_.aa_;
+        int taa = ix_.taa_;
+        vec3 col(0.0f);
+        for (int m = 0; m < aa; ++m)
+        for (int n = 0; n < aa; ++n) {
+            vec2 jitter = aa > 1
+                ? vec2(float(m), float(n)) / float(aa) - 0.5f
+                : vec2(0.0f);
+            for (int t = 0; t < taa; ++t) {
+                float tm = time + float(t)/float(taa)*float(ix_.fdur_);
+                col += sample(frag_coord + jitter, tm);
+            }
+        }
+        col /= float(aa*aa*taa);
+        return glm::pow(col, vec3(0.454545454545454545f));
+    }
+};
+
+} // namespace
+
+void
+cpu_render(
+    Compiled_Shape& shape, const Image_Export& ix, double time,
+    unsigned char* pixels)
+{
+    CPU_Renderer r(shape, ix);
+    int w = ix.size.x;
+    int h = ix.size.y;
+
+    // Threads take tiles from a shared counter. Small tiles balance the
+    // load, since the cost of a pixel varies a lot across the image.
+    constexpr int tile = 16;
+    int ntx = (w + tile - 1) / tile;
+    int nty = (h + tile - 1) / tile;
+    int ntiles = ntx * nty;
+    std::atomic<int> next{0};
+    auto worker = [&]() -> void {
+        for (int k = next++; k < ntiles; k = next++) {
+            int x0 = (k % ntx) * tile;
+            int y0 = (k / ntx) * tile;
+            int x1 = std::min(x0 + tile, w);
+            int y1 = std::min(y0 + tile, h);
+            for (int y = y0; y < y1; ++y) {
+                for (int x = x0; x < x1; ++x) {
+                    // Pixel centres, as in gl_FragCoord, with y=0 at the
+                    // bottom row.
+                    vec3 c = r.pixel(vec2(x + 0.5f, y + 0.5f), float(time));
+                    c = glm::clamp(c, 0.0f, 1.0f);
+                    unsigned char* out = &pixels[(size_t(y) * w + x) * 4];
+                    out[0] = (unsigned char) std::lround(c.x * 255.0f);
+                    out[1] = (unsigned char) std::lround(c.y * 255.0f);
+                    out[2] = (unsigned char) std::lround(c.z * 255.0f);
+                    out[3] = 255;
+                }
+            }
+        }
+    };
+    unsigned nthreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < nthreads; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& t : threads)
+        t.join();
+}
+
+}} // namespace
@@ -0,0 +1,27 @@
+// Copyright 2016-2020 Doug Moen
+// Licensed under the Apache License, version 2.0
+// See accompanying file LICENSE or https://www.apache.org/licenses/LICENSE-2.0
+
+#ifndef LIBCURV_GEOM_CPU_RENDER_H
+#define LIBCURV_GEOM_CPU_RENDER_H
+
+#include <libcurv/geom/png.h>
+
+namespace curv { namespace geom {
+
+struct Compiled_Shape;
+
+// Render an image of a shape on the CPU, without OpenGL, for image export
+// on machines with no GPU. The algorithms and the lighting model are those
+// of the GPU renderer with the standard shader (see frag.cc), with the
+// default camera. The image is divided into small square tiles, which are
+// rendered by a pool of threads.
+//
+// `pixels` receives ix.size.x * ix.size.y RGBA pixels, bottom row first,
+// which is the format used by Image_Renderer and write_png_rgb.
+void cpu_render(
+    Compiled_Shape&, const Image_Export& ix, double time,
+    unsigned char* pixels);
+
+}} // namespace
+#endif // header guard
@@ -4,6 +4,9 @@
 
 #include <libcurv/geom/png.h>
 
+#include <libcurv/geom/compiled_shape.h>
+#include <libcurv/geom/cpu_render.h>
+
 #include <libcurv/shape.h>
 #include <libcurv/viewer/viewer.h>
 #include <libcurv/context.h>
@@ -12,7 +15,9 @@
 
 #include <libcurv/viewer/texture.h>
 
+#include <algorithm>
 #include <cerrno>
+#include <climits>
 #include <chrono>
 #include <cstring>
 #include <iostream>
@@ -25,6 +30,19 @@ namespace curv { namespace geom {
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb/stb_image_write.h"
 
+// stb_image_write computes the size of the filtered image, which has
+// width*3+1 bytes per row, as an int.
+void
+check_png_size(glm::ivec2 size, System& sys)
+{
+    if ((size_t(size.x) * 3 + 1) * size_t(size.y) > size_t(INT_MAX)) {
+        throw Exception(At_System(sys), stringify(
+            "image is too large to encode as PNG: ", size.x, "×", size.y,
+            " pixels (the limit is about ", INT_MAX / 3 / 1000000,
+            " million pixels)"));
+    }
+}
+
 // The input is 4 bytes per pixel (RGBA).
 // The output is 3 bytes per pixel (RGB), and the image is flipped on Y.
 void
@@ -32,12 +50,13 @@ write_png_rgb(
     const std::string& path, unsigned char* pixels, int width, int height,
     System& sys)
 {
+    check_png_size({width, height}, sys);
     using uchar = unsigned char;
-    std::unique_ptr<uchar[]> result(new uchar[width*height*3]);
+    std::unique_ptr<uchar[]> result(new uchar[size_t(width) * height * 3]);
 
     for (int y = 0; y < height; ++y) {
-        uchar* irow = &pixels[(height - 1 - y) * width * 4];
-        uchar* orow = &result[y * width * 3];
+        uchar* irow = &pixels[size_t(height - 1 - y) * width * 4];
+        uchar* orow = &result[size_t(y) * width * 3];
         for (int x = 0; x < width; ++x) {
             uchar* ipix = &irow[x * 4];
             uchar* opix = &orow[x * 3];
@@ -54,6 +73,276 @@ write_png_rgb(
     }
 }
 
+Image_Renderer::Image_Renderer(
+    const Shape_Program& shape,
+    const Image_Export& p)
+:
+    size_(p.size),
+    ix_(p)
+{
+    if (p.cpu_) {
+        if (p.shader_ != Render_Opts::Shader::standard) {
+            throw Exception(At_System(shape.system_),
+                "the CPU renderer only supports the standard shader");
+        }
+        cpu_shape_ = std::make_unique<Compiled_Shape>(shape);
+        tile_ = size_;
+        ntiles_ = {1, 1};
+        return;
+    }
+
+    // Large images are rendered in tiles, to stay within the driver's
+    // maximum viewport and renderbuffer size, and so that no single draw
+    // call runs long enough to trigger a GPU watchdog timeout (hence the
+    // tile size is reduced for large AA factors).
+    constexpr int max_tile_side = 4096;
+    int side = std::max(256, max_tile_side / std::max(1, p.aa_));
+    tile_ = glm::min(size_, glm::ivec2(side, side));
+
+    Render_Opts opts{ p };
+    viewer_ = std::make_unique<viewer::Viewer>();
+    viewer_->window_size_.x = tile_.x;
+    viewer_->window_size_.y = tile_.y;
+    viewer_->headless_ = true;
+    viewer_->config_.verbose_ = p.verbose_;
+    viewer_->set_shape_no_hud(shape, opts);
+    viewer_->open();
+
+    GLint max_renderbuffer = 0;
+    GLint max_viewport[2] = {0, 0};
+    glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &max_renderbuffer);
+    glGetIntegerv(GL_MAX_VIEWPORT_DIMS, max_viewport);
+    glm::ivec2 limit = glm::min(
+        glm::ivec2(max_viewport[0], max_viewport[1]),
+        glm::ivec2(max_renderbuffer, max_renderbuffer));
+    if (limit.x > 0 && limit.y > 0
+        && (tile_.x > limit.x || tile_.y > limit.y))
+    {
+        tile_ = glm::min(tile_, limit);
+        viewer_->setWindowSize(tile_.x, tile_.y);
+    }
+    ntiles_ = (size_ + tile_ - 1) / tile_;
+    if (p.verbose_ && tiled()) {
+        std::cerr << "rendering " << ntiles_.x << "×" << ntiles_.y
+            << " tiles of " << tile_.x << "×" << tile_.y << " pixels\n";
+    }
+
+    // According to the GLFW docs, the framebuffer of a hidden window might
+    // not be useable, so we render into a FBO.
+    glGenRenderbuffers(1, &rbo_);
+    glBindRenderbuffer(GL_RENDERBUFFER, rbo_);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, tile_.x, tile_.y);
+    glGenFramebuffers(1, &fbo_);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+        GL_RENDERBUFFER, rbo_);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenBuffers(2, pbo_);
+    for (auto pbo : pbo_) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, tile_.x*tile_.y*4, nullptr,
+            GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+Image_Renderer::~Image_Renderer()
+{
+    if (viewer_ == nullptr) return;
+    glDeleteBuffers(2, pbo_);
+    glDeleteFramebuffers(1, &fbo_);
+    glDeleteRenderbuffers(1, &rbo_);
+    viewer_->close();
+}
+
+// Render tile number `k` at time `time`, and start an asynchronous copy of
+// its pixels into `pbo`.
+void
+Image_Renderer::start_tile(double time, int k, unsigned pbo)
+{
+    glm::ivec2 offset = tile_ * glm::ivec2(k % ntiles_.x, k / ntiles_.x);
+    glm::ivec2 extent = glm::min(tile_, size_ - offset);
+    if (tiled())
+        viewer_->render_offscreen(time, fbo_, size_, offset);
+    else
+        viewer_->render_offscreen(time, fbo_);
+
+    // We request GL_RGBA format (which has 4 byte alignment), instead of GL_RGB
+    // format (which has 3 byte alignment), to avoid a problem with the driver
+    // substituting formats due to alignment.
+    // See: https://www.khronos.org/opengl/wiki/Common_Mistakes
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo_);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+    glReadPixels(0, 0, extent.x, extent.y, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glFlush();
+}
+
+// Wait for the pixels of tile number `k` to arrive in `pbo`, then copy them
+// into their place in `pixels`.
+void
+Image_Renderer::finish_tile(int k, unsigned pbo, unsigned char* pixels)
+{
+    glm::ivec2 offset = tile_ * glm::ivec2(k % ntiles_.x, k / ntiles_.x);
+    glm::ivec2 extent = glm::min(tile_, size_ - offset);
+    size_t row = size_t(extent.x) * 4;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+    auto data = (const unsigned char*) glMapBufferRange(GL_PIXEL_PACK_BUFFER,
+        0, row * extent.y, GL_MAP_READ_BIT);
+    for (int y = 0; y < extent.y; ++y) {
+        unsigned char* out =
+            &pixels[(size_t(offset.y + y) * size_.x + offset.x) * 4];
+        if (data != nullptr)
+            memcpy(out, data + y * row, row);
+        else
+            memset(out, 0, row);
+    }
+    if (data != nullptr)
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void
+Image_Renderer::start(double time)
+{
+    if (tiled() || cpu_shape_) {
+        // Render in finish(): a tiled image needs both of the PBOs,
+        // and the CPU renderer is synchronous.
+        times_.push_back(time);
+        return;
+    }
+    start_tile(time, 0, pbo_[next_]);
+    next_ = (next_ + 1) % 2;
+    ++inflight_;
+}
+
+void
+Image_Renderer::finish(unsigned char* pixels)
+{
+    if (cpu_shape_) {
+        double time = times_.front();
+        times_.pop_front();
+        cpu_render(*cpu_shape_, ix_, time, pixels);
+        return;
+    }
+    if (tiled()) {
+        // Tile k is rendered while tile k-1 is copied out of its PBO.
+        double time = times_.front();
+        times_.pop_front();
+        int n = ntiles_.x * ntiles_.y;
+        for (int k = 0; k <= n; ++k) {
+            if (k < n)
+                start_tile(time, k, pbo_[k % 2]);
+            if (k > 0)
+                finish_tile(k - 1, pbo_[(k - 1) % 2], pixels);
+        }
+        return;
+    }
+    // The oldest image in flight is in the PBO before next_.
+    unsigned pbo = pbo_[(next_ + 2 - inflight_) % 2];
+    --inflight_;
+    finish_tile(0, pbo, pixels);
+}
+
+void
+set_png_compression(int level)
+{
+    stbi_write_png_compression_level = level;
+}
+
+PNG_Writer::PNG_Writer(unsigned nthreads)
+{
+    if (nthreads == 0) {
+        unsigned hw = std::thread::hardware_concurrency();
+        nthreads = hw > 1 ? hw - 1 : 1;
+    }
+    max_jobs_ = 2 * nthreads;
+    for (unsigned i = 0; i < nthreads; ++i)
+        threads_.emplace_back([this]{ run(); });
+}
+
+PNG_Writer::~PNG_Writer()
+{
+    {
+        // Images not yet written when an exception is thrown are dropped.
+        std::unique_lock<std::mutex> lock(mutex_);
+        jobs_.clear();
+        exit_ = true;
+    }
+    cond_.notify_all();
+    for (auto& t : threads_)
+        t.join();
+}
+
+void
+PNG_Writer::check_error(std::unique_lock<std::mutex>&)
+{
+    if (error_) {
+        auto e = error_;
+        error_ = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+void
+PNG_Writer::write(
+    std::unique_ptr<Output_File> ofile,
+    std::unique_ptr<unsigned char[]> pixels,
+    glm::ivec2 size)
+{
+    // Create the tempfile on this thread; creating tempfiles is not
+    // thread safe.
+    ofile->path();
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [&]{ return jobs_.size() < max_jobs_ || error_; });
+    check_error(lock);
+    jobs_.push_back(Job{std::move(ofile), std::move(pixels), size});
+    lock.unlock();
+    cond_.notify_all();
+}
+
+void
+PNG_Writer::finish()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [&]{ return (jobs_.empty() && busy_ == 0) || error_; });
+    check_error(lock);
+}
+
+void
+PNG_Writer::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        cond_.wait(lock, [&]{ return !jobs_.empty() || exit_; });
+        if (jobs_.empty())
+            return;
+        Job job = std::move(jobs_.front());
+        jobs_.pop_front();
+        ++busy_;
+        lock.unlock();
+        cond_.notify_all();
+
+        std::exception_ptr error;
+        try {
+            write_png_rgb(job.ofile_->tempfile_path_.string(), job.pixels_.get(),
+                job.size_.x, job.size_.y, job.ofile_->system_);
+            job.ofile_->commit();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        job = Job{};
+
+        lock.lock();
+        --busy_;
+        if (error && !error_)
+            error_ = error;
+        cond_.notify_all();
+    }
+}
+
 void
 export_png(
     const Shape_Program& shape,
@@ -69,62 +358,18 @@ export_png(
     };
     (void) origin; // TODO
 
-    Render_Opts opts{ p };
-    /*
-    opts.aa_ = p.aa_;
-    opts.taa_ = p.taa_;
-    opts.fdur_ = p.fdur_;
-     */
-
-    viewer::Viewer v;
-    v.window_size_.x = p.size.x;
-    v.window_size_.y = p.size.y;
-    v.headless_ = true;
-    v.config_.verbose_ = p.verbose_;
-    v.set_shape_no_hud(shape, opts);
-    v.open();
-    v.current_time_ = p.fstart_;
+    check_png_size(p.size, shape.system_);
+    set_png_compression(p.png_compression_);
+    Image_Renderer renderer(shape, p);
+    std::unique_ptr<unsigned char[]> pixels(
+        new unsigned char[size_t(p.size.x) * p.size.y * 4]);
 
     std::chrono::time_point<std::chrono::steady_clock> start_time, end_time;
     start_time = std::chrono::steady_clock::now();
-    v.draw_frame();
-#if 1
-    // TODO: use a FBO to render the exported image.
-    // On macOS, the second call to draw_frame() is needed, or glReadPixels
-    // will store zeroes in `pixels`.
-    // I think the problem is related to double buffering: only after the
-    // second call to draw_frame() do both of the buffers contain the image.
-    // On Linux, I don't need 2 calls. How to fix?
-    // * Calling glFinish() doesn't help.
-    // * Try render to a Frame Buffer Object (FBO).
-    // According to the GLFW docs, I need an FBO because the framebuffer of
-    // a hidden window might not be useable.
-    v.current_time_ = p.fstart_;
-    v.draw_frame();
-#endif
-    glFinish();
-
-    // Read the pixels into CPU memory.
-    // We request GL_RGBA format (which has 4 byte alignment), instead of GL_RGB
-    // format (which has 3 byte alignment), to avoid a problem with the driver
-    // substituting formats due to alignment.
-    // See: https://www.khronos.org/opengl/wiki/Common_Mistakes
-    std::unique_ptr<unsigned char[]> pixels(new unsigned char[p.size.x*p.size.y*4]);
-    glGetError();
-    glReadPixels(0, 0, p.size.x, p.size.y, GL_RGBA, GL_UNSIGNED_BYTE, pixels.get());
-    auto err = glGetError();
+    renderer.start(p.fstart_);
+    renderer.finish(pixels.get());
     end_time = std::chrono::steady_clock::now();
 
-    v.close();
-#if 0
-    std::cerr << "err="<<int(err)<<" RGBA[0,0]: "
-        <<int(pixels[0])<<","
-        <<int(pixels[1])<<","
-        <<int(pixels[2])<<","
-        <<int(pixels[3])<<"\n";
-#else
-    (void) err;
-#endif
     if (p.verbose_) {
         std::chrono::duration<double> render_time = end_time - start_time;
         std::cerr << "image render time: " << render_time.count() << "s\n";
@@ -7,10 +7,24 @@
 
 #include <libcurv/render.h>
 #include <glm/vec2.hpp>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace curv {
 struct Output_File;
 struct Shape_Program;
+struct System;
+namespace viewer { struct Viewer; }
+
+namespace geom {
+struct Compiled_Shape;
+}
 
 namespace geom {
 
@@ -22,9 +36,107 @@ struct Image_Export : public Render_Opts
     double pixel_size;  // Size of a square pixel, in shape space.
     double fstart_ = 0.0;  // Frame start time, in seconds, for animations.
     bool verbose_ = false;
+    // PNG compression effort: higher is smaller and slower. Minimum 5.
+    int png_compression_ = 8;
+    // Render on the CPU, using JIT compiled code, instead of using OpenGL.
+    bool cpu_ = false;
 };
 
 void export_png(const Shape_Program&, const Image_Export&, Output_File&);
 
+// Throw an exception if an image of this size can't be written as a PNG
+// file. Called before rendering, so that the time isn't wasted.
+void check_png_size(glm::ivec2 size, System&);
+
+// Write an image to a PNG file. The input is 4 bytes per pixel (RGBA),
+// bottom row first, as returned by Image_Renderer.
+void write_png_rgb(
+    const std::string& path, unsigned char* pixels, int width, int height,
+    System&);
+
+// Set the compression effort used by write_png_rgb. Not thread safe:
+// call before starting any threads that write PNG files.
+void set_png_compression(int level);
+
+// Writes PNG files on a pool of worker threads, so that the slow parts
+// (flipping, deflate compression and file output) overlap with rendering
+// the next images of an animation. The number of queued images is bounded,
+// to bound memory use: write() blocks while the queue is full.
+struct PNG_Writer
+{
+    // nthreads == 0 means one fewer than the number of hardware threads.
+    explicit PNG_Writer(unsigned nthreads = 0);
+    ~PNG_Writer();
+
+    // Queue an image for writing to `ofile`, which is then committed.
+    // `pixels` is in the format used by write_png_rgb.
+    // An exception thrown while writing a previous image is rethrown here.
+    void write(std::unique_ptr<Output_File> ofile,
+        std::unique_ptr<unsigned char[]> pixels, glm::ivec2 size);
+
+    // Wait until all queued images are written. Rethrows the first error.
+    void finish();
+
+private:
+    struct Job {
+        std::unique_ptr<Output_File> ofile_;
+        std::unique_ptr<unsigned char[]> pixels_;
+        glm::ivec2 size_;
+    };
+    std::mutex mutex_;
+    std::condition_variable cond_; // jobs_, busy_ or exit_ has changed
+    std::deque<Job> jobs_;
+    unsigned max_jobs_;
+    unsigned busy_ = 0;            // # of jobs being written
+    bool exit_ = false;
+    std::exception_ptr error_;
+    std::vector<std::thread> threads_;
+
+    void run();
+    void check_error(std::unique_lock<std::mutex>&);
+};
+
+// Renders images of a shape without a visible window, for exporting
+// an image or an animation. One hidden window (which supplies the OpenGL
+// context) and one framebuffer object are created by the constructor, and
+// reused for each image. Pixels are read back through two pixel buffer
+// objects, so the GPU can render image i+1 while image i is being copied to
+// CPU memory. Images too large to render in one pass are rendered as a grid
+// of tiles, and the GPU renders tile k+1 while tile k is being copied.
+// If ix.cpu_ is set, images are rendered by cpu_render() instead, and
+// OpenGL is not used.
+struct Image_Renderer
+{
+    Image_Renderer(const Shape_Program&, const Image_Export&);
+    ~Image_Renderer();
+
+    // Start rendering an image at animation time `time`. At most two images
+    // can be in flight: call finish() before starting a third one.
+    void start(double time);
+
+    // Wait for the oldest image in flight, and copy its pixels into `pixels`
+    // (size_t(size.x) * size.y * 4 bytes, in the format used by
+    // write_png_rgb).
+    void finish(unsigned char* pixels);
+
+private:
+    glm::ivec2 size_;
+    const Image_Export& ix_;
+    glm::ivec2 tile_;       // size of one tile
+    glm::ivec2 ntiles_;     // number of tiles in each dimension
+    std::deque<double> times_; // times of images not yet rendered
+    std::unique_ptr<viewer::Viewer> viewer_;
+    std::unique_ptr<Compiled_Shape> cpu_shape_;
+    unsigned fbo_ = 0;
+    unsigned rbo_ = 0;
+    unsigned pbo_[2] = {0, 0};
+    unsigned next_ = 0;     // PBO that the next image is read into
+    unsigned inflight_ = 0; // # of images started but not finished
+
+    bool tiled() const { return ntiles_.x * ntiles_.y > 1; }
+    void start_tile(double time, int k, unsigned pbo);
+    void finish_tile(int k, unsigned pbo, unsigned char* pixels);
+};
+
 }} // namespace
 #endif // header guard
@@ -0,0 +1,121 @@
+// Copyright 2016-2020 Doug Moen
+// Licensed under the Apache License, version 2.0
+// See accompanying file LICENSE or https://www.apache.org/licenses/LICENSE-2.0
+
+#include <libcurv/geom/video.h>
+
+#include <libcurv/context.h>
+#include <libcurv/exception.h>
+#include <libcurv/shape.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+
+namespace curv { namespace geom {
+
+namespace {
+
+// Convert an RGBA image (bottom row first, as returned by Image_Renderer)
+// to planar Y'CbCr 4:2:0, using the BT.601 matrix with limited ("studio")
+// range, which is what Y4M readers assume. The chroma of each 2×2 block
+// of pixels is averaged. Odd sizes are handled by clamping to the edge.
+void
+rgba_to_yuv420(
+    const unsigned char* rgba, int width, int height, unsigned char* out)
+{
+    int cw = (width + 1) / 2;
+    int ch = (height + 1) / 2;
+    unsigned char* yplane = out;
+    unsigned char* uplane = yplane + size_t(width) * height;
+    unsigned char* vplane = uplane + size_t(cw) * ch;
+
+    auto pixel = [&](int x, int y) -> const unsigned char* {
+        x = std::min(x, width - 1);
+        y = std::min(y, height - 1);
+        return &rgba[(size_t(height - 1 - y) * width + x) * 4];
+    };
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const unsigned char* p = pixel(x, y);
+            double luma = 16.0 + 0.256788*p[0] + 0.504129*p[1] + 0.097906*p[2];
+            yplane[size_t(y) * width + x] = (unsigned char) std::lround(luma);
+        }
+    }
+    for (int y = 0; y < ch; ++y) {
+        for (int x = 0; x < cw; ++x) {
+            double r = 0.0, g = 0.0, b = 0.0;
+            for (int i = 0; i < 4; ++i) {
+                const unsigned char* p = pixel(2*x + (i&1), 2*y + (i>>1));
+                r += p[0]; g += p[1]; b += p[2];
+            }
+            r /= 4.0; g /= 4.0; b /= 4.0;
+            double cb = 128.0 - 0.148223*r - 0.290993*g + 0.439216*b;
+            double cr = 128.0 + 0.439216*r - 0.367788*g - 0.071427*b;
+            uplane[size_t(y) * cw + x] = (unsigned char) std::lround(cb);
+            vplane[size_t(y) * cw + x] = (unsigned char) std::lround(cr);
+        }
+    }
+}
+
+} // namespace
+
+void
+export_y4m(
+    const Shape_Program& shape,
+    const Image_Export& ix,
+    unsigned nframes,
+    std::ostream& out)
+{
+    int w = ix.size.x;
+    int h = ix.size.y;
+
+    // The frame rate is a ratio of integers.
+    double fps = 1.0 / ix.fdur_;
+    long num, den;
+    if (std::abs(fps - std::round(fps)) < 1e-6) {
+        num = std::lround(fps);
+        den = 1;
+    } else {
+        num = std::lround(fps * 1000.0);
+        den = 1000;
+    }
+    out << "YUV4MPEG2 W" << w << " H" << h << " F" << num << ":" << den
+        << " Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n";
+
+    size_t nbytes = size_t(w) * h + 2 * size_t((w+1)/2) * ((h+1)/2);
+    std::unique_ptr<unsigned char[]> pixels(
+        new unsigned char[size_t(w) * h * 4]);
+    std::unique_ptr<unsigned char[]> frame(new unsigned char[nbytes]);
+
+    // One renderer is used for the whole stream. Frame i+1 is rendered
+    // while frame i is converted and written.
+    Image_Renderer renderer(shape, ix);
+    auto write_frame = [&]() -> void {
+        renderer.finish(pixels.get());
+        rgba_to_yuv420(pixels.get(), w, h, frame.get());
+        out << "FRAME\n";
+        out.write((const char*) frame.get(), nbytes);
+        if (!out)
+            throw Exception(At_System(shape.system_),
+                "error writing video stream");
+    };
+    auto start_time = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < nframes; ++i) {
+        renderer.start(ix.fstart_ + i * ix.fdur_);
+        if (i > 0)
+            write_frame();
+    }
+    write_frame();
+    out.flush();
+    if (ix.verbose_) {
+        std::chrono::duration<double> export_time =
+            std::chrono::steady_clock::now() - start_time;
+        std::cerr << nframes << " frames exported in "
+            << export_time.count() << "s\n";
+    }
+}
+
+}} // namespace
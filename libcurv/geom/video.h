@@ -0,0 +1,25 @@
+// Copyright 2016-2020 Doug Moen
+// Licensed under the Apache License, version 2.0
+// See accompanying file LICENSE or https://www.apache.org/licenses/LICENSE-2.0
+
+#ifndef LIBCURV_GEOM_VIDEO_H
+#define LIBCURV_GEOM_VIDEO_H
+
+#include <libcurv/geom/png.h>
+#include <ostream>
+
+namespace curv {
+struct Shape_Program;
+
+namespace geom {
+
+// Export `nframes` frames of an animation as a YUV4MPEG2 (Y4M) stream:
+// uncompressed 4:2:0 video, which can be piped into a video encoder such
+// as ffmpeg. Frame i is rendered at time ix.fstart_ + i * ix.fdur_, and the
+// frame rate is 1/ix.fdur_.
+void export_y4m(
+    const Shape_Program&, const Image_Export& ix, unsigned nframes,
+    std::ostream&);
+
+}} // namespace
+#endif // header guard
@@ -10,6 +10,12 @@
 #include <libcurv/shape.h>
 #include <libcurv/viewed_shape.h>
 
+#include <cctype>
+#include <cstring>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
 namespace curv {
 
 const char glsl_header[] = "";
@@ -33,4 +39,173 @@ void glsl_function_export(const Shape_Program& shape, std::ostream& out)
         shape.colour_fun_, cx);
 }
 
+namespace {
+
+// Which components of a GLSL value depend on time: bit i is component i.
+// A scalar, or a value that isn't tracked by component, is 0 or all bits.
+using Time_Mask = unsigned;
+const Time_Mask all_time = 0xF;
+
+bool is_id_start(char c)
+{
+    return std::isalpha((unsigned char)c) || c == '_';
+}
+bool is_id_char(char c)
+{
+    return std::isalnum((unsigned char)c) || c == '_';
+}
+
+// The components of a value selected by a suffix like "[2]" or ".xy",
+// or all of them.
+Time_Mask
+select_components(const std::string& code, size_t& pos, Time_Mask m)
+{
+    if (pos + 2 < code.size() && code[pos] == '['
+        && std::isdigit((unsigned char)code[pos+1]) && code[pos+2] == ']')
+    {
+        Time_Mask c = m & (1u << (code[pos+1] - '0'));
+        pos += 3;
+        return c ? all_time : 0;
+    }
+    if (pos < code.size() && code[pos] == '.') {
+        Time_Mask c = 0;
+        size_t i = pos + 1;
+        for (; i < code.size() && is_id_char(code[i]); ++i) {
+            const char* xyzw = std::strchr("xyzw", code[i]);
+            if (xyzw == nullptr)
+                return m ? all_time : 0;
+            c |= m & (1u << (xyzw - "xyzw"));
+        }
+        pos = i;
+        return c ? all_time : 0;
+    }
+    return m ? all_time : 0;
+}
+
+// The time dependence of an expression, given that of the variables.
+Time_Mask
+expr_time(
+    const std::string& expr,
+    const std::unordered_map<std::string, Time_Mask>& vars)
+{
+    Time_Mask result = 0;
+    for (size_t pos = 0; pos < expr.size(); ) {
+        if (!is_id_start(expr[pos])) {
+            ++pos;
+            continue;
+        }
+        size_t start = pos;
+        while (pos < expr.size() && is_id_char(expr[pos]))
+            ++pos;
+        auto v = vars.find(expr.substr(start, pos - start));
+        if (v != vars.end())
+            result |= select_components(expr, pos, v->second);
+    }
+    return result;
+}
+
+// The time dependence of an expression, by component if the expression
+// is a vector constructor like `vec4(r1,r2,r3,r4)`.
+Time_Mask
+value_time(
+    const std::string& expr,
+    const std::unordered_map<std::string, Time_Mask>& vars)
+{
+    if (expr.compare(0, 3, "vec") == 0 && expr.size() > 5
+        && expr[4] == '(' && expr.back() == ')'
+        && expr.find('(', 5) == std::string::npos)
+    {
+        std::vector<std::string> args;
+        size_t pos = 5;
+        for (;;) {
+            size_t comma = expr.find(',', pos);
+            if (comma == std::string::npos) {
+                args.push_back(expr.substr(pos, expr.size() - 1 - pos));
+                break;
+            }
+            args.push_back(expr.substr(pos, comma - pos));
+            pos = comma + 1;
+        }
+        if (args.size() == size_t(expr[3] - '0')) {
+            Time_Mask m = 0;
+            for (size_t i = 0; i < args.size(); ++i) {
+                if (expr_time(args[i], vars))
+                    m |= 1u << i;
+            }
+            return m;
+        }
+    }
+    return expr_time(expr, vars) ? all_time : 0;
+}
+
+// Track time, the 4th component of the argument of a function generated by
+// the SC compiler, through the function's statements. The SC compiler
+// unpacks its argument into components, and transformations repack them,
+// so most shapes that don't depend on time still copy it around.
+bool function_uses_time(const std::string& frag, const char* header)
+{
+    size_t pos = frag.find(header);
+    if (pos == std::string::npos)
+        return true;
+    pos += std::strlen(header);
+    size_t close = frag.find(')', pos);
+    size_t end = frag.find("\n}\n", pos);
+    if (close == std::string::npos || end == std::string::npos)
+        return true;
+    std::vector<std::string> lines;
+    std::istringstream body(frag.substr(close + 1, end - close - 1));
+    for (std::string line; std::getline(body, line); ) {
+        auto first = line.find_first_not_of(' ');
+        if (first != std::string::npos)
+            lines.push_back(line.substr(first));
+    }
+
+    std::unordered_map<std::string, Time_Mask> vars;
+    vars[frag.substr(pos, close - pos)] = 1u << 3;
+    // Variables are reassigned in loops, so repeat until nothing changes.
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (auto& line : lines) {
+            if (line.compare(0, 7, "return ") == 0) {
+                if (expr_time(line.substr(7), vars))
+                    return true;
+                continue;
+            }
+            // An assignment, `[<type>] <var> = <expr>;`.
+            size_t eq = line.find('=');
+            if (eq != std::string::npos && eq > 0 && line.back() == ';'
+                && line.compare(0, 4, "for ") != 0
+                && line[eq+1] != '=' && std::strchr("!<>", line[eq-1]) == 0)
+            {
+                size_t vend = line.find_last_not_of(' ', eq - 1) + 1;
+                size_t vstart = vend;
+                while (vstart > 0 && is_id_char(line[vstart-1]))
+                    --vstart;
+                std::string var = line.substr(vstart, vend - vstart);
+                size_t estart = line.find_first_not_of(' ', eq + 1);
+                Time_Mask m = value_time(
+                    line.substr(estart, line.size() - 1 - estart), vars);
+                Time_Mask& vm = vars[var];
+                if ((vm | m) != vm) {
+                    vm |= m;
+                    changed = true;
+                }
+                continue;
+            }
+            // Control flow that depends on time.
+            if (expr_time(line, vars))
+                return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+bool glsl_uses_time(const std::string& frag)
+{
+    return function_uses_time(frag, "float dist(vec4 ")
+        || function_uses_time(frag, "vec3 colour(vec4 ");
+}
+
 } // namespace
@@ -6,6 +6,7 @@
 #define LIBCURV_GLSL_H
 
 #include <ostream>
+#include <string>
 
 namespace curv {
 
@@ -17,5 +18,10 @@ extern const char glsl_header[];
 // Export a shape's dist and colour functions as a set of GLSL definitions.
 void glsl_function_export(const Shape_Program&, std::ostream&);
 
+// True if the dist or colour function in a frag shader generated from
+// glsl_function_export depends on time, the 4th component of its argument.
+// The result errs on the side of true.
+bool glsl_uses_time(const std::string& frag);
+
 } // namespace
 #endif // header guard
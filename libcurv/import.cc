@@ -9,7 +9,14 @@
 #include <libcurv/exception.h>
 #include <libcurv/program.h>
 #include <libcurv/system.h>
+#include <chrono>
 #include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <unordered_set>
 
 namespace curv {
 
@@ -31,32 +38,223 @@ Value import(const Filesystem::path& path, const Context& cx)
 
     // Import file based on extension
     auto importp = sys.importers_.find(ext);
-    if (importp != sys.importers_.end())
+    if (importp != sys.importers_.end()) {
+        if (importp->second != curv_import)
+            depend_on_file(path, cx);
         return (*importp->second)(path, cx);
-    else {
+    } else {
         // If extension not recognized, it defaults to a Curv program.
         return curv_import(path, cx);
     }
 }
 
+// File timestamps are only as fine as the file system (2 seconds on FAT)
+// and the kernel's clock tick, so a file can be rewritten without changing
+// its mtime or size. That can only happen while the mtime is within this
+// window of the current time, so only then are the contents hashed as well.
+static constexpr std::chrono::seconds mtime_granularity{2};
+
+namespace {
+
+// Get the mtime and size of a file, without hashing it. `recent` is set if
+// the mtime is within mtime_granularity of the current time.
+File_Stamp
+stat_file(
+    const std::filesystem::path& path,
+    boost::system::error_code& ec,
+    bool& recent)
+{
+    File_Stamp stamp;
+    recent = false;
+    std::error_code sec;
+    auto status = std::filesystem::status(path, sec);
+    auto mtime = sec ? std::filesystem::file_time_type{}
+        : std::filesystem::last_write_time(path, sec);
+    if (!sec && !std::filesystem::is_directory(status))
+        stamp.size_ = std::filesystem::file_size(path, sec);
+    if (sec) {
+        ec.assign(sec.value(), boost::system::system_category());
+        return File_Stamp{};
+    }
+    ec.clear();
+    stamp.mtime_ = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        mtime.time_since_epoch()).count();
+    // Adding or removing a file changes the mtime of a directory, but
+    // directories are not hashed.
+    recent = !std::filesystem::is_directory(status)
+        && std::filesystem::file_time_type::clock::now() - mtime
+            < mtime_granularity;
+    return stamp;
+}
+
+std::size_t
+hash_file(const std::filesystem::path& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::string data{std::istreambuf_iterator<char>(in),
+                     std::istreambuf_iterator<char>()};
+    return std::hash<std::string>{}(data);
+}
+
+} // namespace
+
+File_Stamp
+get_file_stamp(const Filesystem::path& path, boost::system::error_code& ec)
+{
+    std::filesystem::path p(path.native());
+    bool recent;
+    File_Stamp stamp = stat_file(p, ec, recent);
+    if (recent) {
+        stamp.hashed_ = true;
+        stamp.hash_ = hash_file(p);
+    }
+    return stamp;
+}
+
+bool
+file_is_current(const Filesystem::path& path, File_Stamp& stamp)
+{
+    std::filesystem::path p(path.native());
+    boost::system::error_code ec;
+    bool recent;
+    File_Stamp now = stat_file(p, ec, recent);
+    if (ec)
+        return stamp == File_Stamp{};
+    if (now.mtime_ != stamp.mtime_ || now.size_ != stamp.size_)
+        return false;
+    if (stamp.hashed_) {
+        if (hash_file(p) != stamp.hash_)
+            return false;
+        // A rewrite after this point would change the mtime.
+        if (!recent) {
+            stamp.hashed_ = false;
+            stamp.hash_ = 0;
+        }
+    }
+    return true;
+}
+
+static void
+add_dependency(System& sys, const Filesystem::path& key, File_Stamp stamp)
+{
+    if (sys.import_deps_ != nullptr)
+        sys.import_deps_->files_[key] = stamp;
+}
+
+void depend_on_file(const Filesystem::path& path, const Context& cx)
+{
+    System& sys{cx.system()};
+    if (sys.import_deps_ == nullptr)
+        return;
+    boost::system::error_code ec;
+    auto key = Filesystem::canonical(path, ec);
+    if (ec) return;
+    auto stamp = get_file_stamp(key, ec);
+    if (ec) return;
+    add_dependency(sys, key, stamp);
+}
+
+// Test if the dependencies of a cache entry are unchanged. Dependencies that
+// are themselves cached Curv files are checked recursively.
+static bool
+is_current(
+    System& sys,
+    const Import_Cache_Entry& entry,
+    std::unordered_set<Filesystem::path,Path_Hash>& visited)
+{
+    for (auto& d : entry.deps_->files_) {
+        if (!visited.insert(d.first).second)
+            continue;
+        if (!file_is_current(d.first, d.second))
+            return false;
+        auto c = sys.import_cache_.find(d.first);
+        if (c != sys.import_cache_.end() && !is_current(sys, c->second, visited))
+            return false;
+    }
+    return true;
+}
+
+void
+collect_import_deps(
+    System& sys,
+    const Import_Deps& deps,
+    std::map<Filesystem::path, File_Stamp>& files)
+{
+    for (auto& d : deps.files_) {
+        if (!files.emplace(d.first, d.second).second)
+            continue;
+        auto c = sys.import_cache_.find(d.first);
+        if (c != sys.import_cache_.end())
+            collect_import_deps(sys, *c->second.deps_, files);
+    }
+}
+
 Value curv_import(const Filesystem::path& path, const Context& cx)
 {
     System& sys{cx.system()};
+
+    // Reuse the value from an earlier import of the same file, if the file
+    // and its dependencies haven't changed since.
+    boost::system::error_code ec;
+    auto filekey = Filesystem::canonical(path, ec);
+    auto& active_files = sys.active_files_;
+    File_Stamp stamp;
+    if (!ec) {
+        // A cached value can't be reused while the file is being evaluated,
+        // or while one of its fields is being forced (see Thunk).
+        if (active_files.find(filekey) != active_files.end())
+            throw Exception{cx,
+                stringify("illegal recursive reference to file ",path)};
+        auto c = sys.import_cache_.find(filekey);
+        if (c != sys.import_cache_.end()) {
+            std::unordered_set<Filesystem::path,Path_Hash> visited;
+            if (file_is_current(filekey, c->second.stamp_)
+                && is_current(sys, c->second, visited))
+            {
+                add_dependency(sys, filekey, c->second.stamp_);
+                return c->second.value_;
+            }
+            sys.import_cache_.erase(c);
+        }
+        stamp = get_file_stamp(filekey, ec);
+    }
+
     auto source = make<File_Source>(make_string(path.string().c_str()), cx);
     Program prog{std::move(source), sys,
         Program_Opts().file_frame(cx.frame())};
-    auto filekey = Filesystem::canonical(path);
-    auto& active_files = sys.active_files_;
+    if (ec)
+        filekey = Filesystem::canonical(path);
     if (active_files.find(filekey) != active_files.end())
         throw Exception{cx,
             stringify("illegal recursive reference to file ",path)};
     Active_File af(active_files, filekey);
-    prog.compile();
-    return prog.eval();
+    if (!ec)
+        add_dependency(sys, filekey, stamp);
+    auto deps = make<Import_Deps>();
+    deps->file_ = filekey;
+    Value value;
+    try {
+        Current_Import_Deps cdeps(sys, deps);
+        prog.compile();
+        value = prog.eval();
+    } catch (...) {
+        // The importer still depends on the files that were read: a change
+        // to one of them might fix the error.
+        if (sys.import_deps_ != nullptr) {
+            for (auto& d : deps->files_)
+                sys.import_deps_->files_.insert(d);
+        }
+        throw;
+    }
+    if (!ec)
+        sys.import_cache_[filekey] = Import_Cache_Entry{stamp, value, deps};
+    return value;
 }
 
 Value dir_import(const Filesystem::path& dir, const Context& cx)
 {
+    // Adding or removing a file changes the directory's mtime.
+    depend_on_file(dir, cx);
     return {make<Dir_Record>(dir, cx)};
 }
 
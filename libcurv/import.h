@@ -6,7 +6,9 @@
 #define LIBCURV_IMPORT_H
 
 #include <libcurv/filesystem.h>
+#include <libcurv/system.h>
 #include <libcurv/value.h>
+#include <map>
 
 namespace curv {
 
@@ -25,5 +27,26 @@ Value curv_import(const Filesystem::path& path, const Context& cx);
 // Import a directory as a record value, using "directory syntax".
 Value dir_import(const Filesystem::path&, const Context&);
 
+// Record that the value of the Curv file currently being imported depends
+// on the contents of `path` (see System::import_cache_).
+void depend_on_file(const Filesystem::path&, const Context&);
+
+// Get the current version of a file or directory. If it can't be read,
+// `ec` is set and the result is File_Stamp{}.
+File_Stamp get_file_stamp(const Filesystem::path&, boost::system::error_code&);
+
+// Test if a file still has the version in `stamp`, from get_file_stamp.
+// A file that can't be read is current if it couldn't be read before.
+// Once the file's mtime is old enough to trust, the hash is dropped from
+// `stamp`, so later calls don't read the file.
+bool file_is_current(const Filesystem::path&, File_Stamp& stamp);
+
+// Add the files in `deps`, and the files that they depend on (transitively,
+// via System::import_cache_), to `files`, with the versions that were read.
+void collect_import_deps(
+    System&,
+    const Import_Deps& deps,
+    std::map<Filesystem::path, File_Stamp>& files);
+
 }
 #endif
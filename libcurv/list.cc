@@ -8,6 +8,8 @@
 #include <libcurv/exception.h>
 #include <libcurv/reactive.h>
 
+#include <algorithm>
+
 namespace curv {
 
 Generic_List::Generic_List(Value val, Fail fl, const Context& cx)
@@ -64,8 +66,12 @@ Value Generic_List::val_at(size_t i, const At_Syntax& cx) const
 }
 void Generic_List::amend_at(size_t i, Value newval, const At_Syntax& cx)
 {
-    if (this->is_boxed_list())
+    if (this->is_boxed_list()) {
+        // copy on write
+        if (list_->use_count > 1)
+            list_ = get_boxed_list().clone();
         get_boxed_list().at(i) = newval;
+    }
     else if (this->is_string())
         throw Exception(cx, "Generic_List: can't amend string");
     else if (this->is_reactive_value())
@@ -171,16 +177,25 @@ Ternary List_Base::equal(const List_Base& list, const Context& cx) const
     return result;
 }
 
+void List_Builder::string_to_list()
+{
+    if (string_) {
+        for (auto c : *string_)
+            list_.push_back({c});
+        string_ = nullptr;
+    }
+    in_string_ = false;
+}
+
 void List_Builder::push_back(Value val)
 {
     if (in_string_) {
         if (val.is_char()) {
-            string_.push_back(val.to_char_unsafe());
+            char c = val.to_char_unsafe();
+            String_Base::append(string_, &c, 1);
             return;
         }
-        for (auto c : string_)
-            list_.push_back({c});
-        in_string_ = false;
+        string_to_list();
     }
     list_.push_back(val);
 }
@@ -189,9 +204,12 @@ void List_Builder::concat(Value val, const Context& cx)
 {
     if (auto strval = val.maybe<String>()) {
         // Strings can't be empty.
-        if (in_string_)
-            string_ += strval->c_str();
-        else {
+        if (in_string_) {
+            if (string_ == nullptr)
+                string_ = strval;
+            else
+                String_Base::append(string_, strval->data(), strval->size());
+        } else {
             for (auto c : *strval)
                 list_.push_back({c});
         }
@@ -199,11 +217,8 @@ void List_Builder::concat(Value val, const Context& cx)
         if (listval->empty()) return;
         // A non-empty List is guaranteed to contain 1 non-character,
         // so we need to switch out of string mode.
-        if (in_string_) {
-            for (auto c : string_)
-                list_.push_back({c});
-            in_string_ = false;
-        }
+        if (in_string_)
+            string_to_list();
         list_.insert(list_.end(), listval->begin(), listval->end());
     } else {
         throw Exception(cx, stringify(val, "is not a list"));
@@ -213,9 +228,9 @@ void List_Builder::concat(Value val, const Context& cx)
 Value List_Builder::get_value()
 {
     if (in_string_) {
-        if (string_.empty())
+        if (string_ == nullptr)
             return {List::make(0)};
-        return {make_string(string_)};
+        return {string_};
     }
     Shared<List> result = List::make_elements(list_);
     return {result};
@@ -226,6 +241,29 @@ Shared<List> List_Base::clone() const
     return List::make_copy(array_, size_);
 }
 
+void List_Base::append(Shared<List>& list, const Abstract_List& tail)
+{
+    size_t size = list->size_;
+    size_t newsize = size + tail.size();
+    if (list->use_count > 1 || newsize > list->capacity()) {
+        size_t cap = std::max(newsize, 2*size);
+        Shared<List> r = make_list(cap);
+        if (list->use_count == 1) {
+            for (size_t i = 0; i < size; ++i)
+                r->array_[i].swap(list->array_[i]);
+        } else {
+            for (size_t i = 0; i < size; ++i)
+                r->array_[i] = list->array_[i];
+        }
+        r->size_ = size;
+        r->capacity_ = cap;
+        list = r;
+    }
+    for (size_t i = 0; i < tail.size(); ++i)
+        list->array_[size + i] = tail.val_at(i);
+    list->size_ = newsize;
+}
+
 Value* List_Base::ref_element(Value index, bool need_value, const Context& cx)
 {
     auto index_list = index.to<List>(cx);
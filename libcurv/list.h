@@ -8,6 +8,7 @@
 #include <libcurv/value.h>
 #include <libcurv/tail_array.h>
 #include <libcurv/alist.h>
+#include <libcurv/string.h>
 #include <string>
 #include <vector>
 
@@ -38,7 +39,22 @@ struct List_Base : public Abstract_List
     Value* ref_element(Value, bool need_value, const Context&);
     Value* ref_lens(Value, bool need_value, const Context&);
 
+    // Number of elements allocated, including spare capacity past size().
+    size_t capacity() const noexcept
+      { return capacity_ > size_ ? capacity_ : size_; }
+
+    // Append the elements of 'tail' to 'list'.
+    // If 'list' holds the only reference to the list, it is extended in
+    // place, otherwise it is copied. When the list is reallocated, the
+    // capacity is doubled, so a loop that builds a list by repeated appends
+    // to a local variable runs in amortized linear time.
+    static void append(Shared<List>& list, const Abstract_List& tail);
+
     static const char name[];
+protected:
+    // Allocated element count, if it exceeds size_. Elements between size_
+    // and capacity_ are missing. Only `append` creates spare capacity.
+    size_t capacity_ = 0;
     TAIL_ARRAY_MEMBERS_MOD_SIZE(Value)
 };
 
@@ -126,8 +142,10 @@ struct List_Builder
 {
 private:
     bool in_string_ = true;
-    std::string string_;
+    // Built in place, so get_value() does not copy it. nullptr if empty.
+    Shared<String> string_ = nullptr;
     std::vector<Value> list_;
+    void string_to_list();
 public:
     void push_back(Value);
     void concat(Value, const Context&);
@@ -495,6 +495,12 @@ struct Scope_Executable
     // actions to execute at runtime: action statements and slot initialization
     std::vector<Shared<const Operation>> actions_ = {};
 
+    // For a lazy module constructor, the index in actions_ of the setter
+    // that initializes each module slot, and the frame size needed to run
+    // a setter on its own. Otherwise, empty. See Thunk.
+    std::vector<size_t> field_actions_ = {};
+    slot_t lazy_nslots_ = 0;
+
     Scope_Executable() {}
 
     /// Initialize the module slot, execute the definitions and action list.
@@ -1061,5 +1067,30 @@ struct Assignment_Action : public Operation
     void sc_exec(SC_Frame&) const override;
 };
 
+// 'var := var ++ tail', where 'var' is a local variable.
+// This is move optimized: if the variable holds the only reference to its
+// list or string, then it is extended in place, rather than being copied.
+// SubCurv code generation is inherited from Assignment_Action.
+struct Append_Local_Action : public Assignment_Action
+{
+    slot_t slot_;
+    Shared<Operation> tail_;
+
+    Append_Local_Action(
+        Shared<const Phrase> syntax,
+        Shared<Locative> locative,
+        Shared<Operation> expr,
+        slot_t slot,
+        Shared<Operation> tail)
+    :
+        Assignment_Action(
+            std::move(syntax), std::move(locative), std::move(expr)),
+        slot_(slot),
+        tail_(std::move(tail))
+    {}
+
+    virtual void exec(Frame&, Executor&) const override;
+};
+
 } // namespace curv
 #endif // header guard
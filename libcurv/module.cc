@@ -3,11 +3,69 @@
 // See accompanying file LICENSE or https://www.apache.org/licenses/LICENSE-2.0
 
 #include <libcurv/module.h>
-#include <libcurv/function.h>
+#include <libcurv/context.h>
 #include <libcurv/exception.h>
+#include <libcurv/frame.h>
+#include <libcurv/function.h>
+#include <libcurv/meaning.h>
+#include <libcurv/system.h>
+#include <optional>
 
 namespace curv {
 
+Thunk::Thunk(
+    Shared<const Operation> setter,
+    System& system,
+    slot_t module_slot,
+    slot_t nslots)
+:
+    Ref_Value(ty_thunk),
+    setter_(std::move(setter)),
+    system_(system),
+    module_slot_(module_slot),
+    nslots_(nslots),
+    import_deps_(system.import_deps_),
+    file_(import_deps_ ? import_deps_->file_ : Filesystem::path())
+{}
+
+void
+Thunk::force(Module_Base& m)
+{
+    // Data definitions are checked for illegal recursion at compile time,
+    // so this is a backstop.
+    if (forcing_)
+        throw Exception(At_Phrase(*setter_->syntax_, system_, nullptr),
+            "illegal recursive reference");
+
+    // The setter overwrites the slots that refer to this Thunk.
+    Shared<Thunk> self = share(*this);
+    forcing_ = true;
+    try {
+        // The file is already active if the field is referenced while the
+        // file is being evaluated, eg by a test.
+        std::optional<Active_File> af;
+        auto& active_files = system_.active_files_;
+        if (!file_.empty() && active_files.find(file_) == active_files.end())
+            af.emplace(active_files, file_);
+        Current_Import_Deps cdeps(system_, import_deps_);
+        std::unique_ptr<Frame> f{
+            Frame::make(nslots_, system_, nullptr, nullptr, nullptr)};
+        (*f)[module_slot_] = {share((Module&)m)};
+        Operation::Action_Executor aex;
+        setter_->exec(*f, aex);
+    } catch (...) {
+        forcing_ = false;
+        throw;
+    }
+    forcing_ = false;
+}
+
+void
+Thunk::print_repr(std::ostream& out) const
+{
+    out << "<thunk>";
+}
+
 const char Module_Base::name[] = "module";
 
 void
@@ -37,6 +95,12 @@ Module_Base::get(slot_t i) const
         auto& ref = val.to_ref_unsafe();
         if (ref.type_ == Ref_Value::ty_lambda)
             return {make<Closure>((Lambda&)ref, *(Module*)this)};
+        // A lazy field is evaluated on first reference, and the result
+        // is cached in the slot.
+        if (ref.type_ == Ref_Value::ty_thunk) {
+            ((Thunk&)ref).force(*(Module*)this);
+            return array_[i];
+        }
     }
     return val;
 }
@@ -60,6 +124,8 @@ Module_Base::hasfield(Symbol_Ref name) const
 Shared<Record>
 Module_Base::clone() const
 {
+    for (slot_t i = 0; i < size_; ++i)
+        (void) get(i);
     return Module::make_copy(&array_[0], size(), dictionary_);
 }
 
@@ -68,8 +134,10 @@ Module_Base::ref_field(Symbol_Ref name, bool need_value, const Context& cx)
 {
     auto b = dictionary_->find(name);
     // WARNING: array_[i] can be a Closure, which is not a proper value.
-    if (b != dictionary_->end())
+    if (b != dictionary_->end()) {
+        (void) get(b->second);
         return &array_[b->second];
+    }
     throw Exception(cx, stringify(Value{share(*this)},
         " has no field named ", name));
 }
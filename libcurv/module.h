@@ -5,6 +5,7 @@
 #ifndef LIBCURV_MODULE_H
 #define LIBCURV_MODULE_H
 
+#include <libcurv/filesystem.h>
 #include <libcurv/record.h>
 #include <libcurv/symbol.h>
 #include <libcurv/shared.h>
@@ -13,6 +14,45 @@
 
 namespace curv {
 
+struct Import_Deps;
+struct Operation;
+struct System;
+struct Module_Base;
+
+/// A Thunk is stored in a module slot whose field has not been evaluated yet.
+///
+/// A module literal at the top level of a source file (such as std.curv) is
+/// evaluated lazily: instead of running each definition when the module is
+/// constructed, the slots bound by a definition initially hold a Thunk that
+/// refers to the definition's setter. The first reference to one of those
+/// slots (via Module_Base::get) forces the Thunk, which runs the setter in a
+/// fresh frame, overwriting the slots with their values.
+///
+/// Like Lambda, a Thunk is not a proper value, and must not escape from the
+/// slot array.
+struct Thunk : public Ref_Value
+{
+    Shared<const Operation> setter_;
+    System& system_;
+    slot_t module_slot_;
+    slot_t nslots_;
+    bool forcing_ = false;
+    // If the module is the value of an imported file, files imported while
+    // forcing are dependencies of that import.
+    Shared<Import_Deps> import_deps_;
+    // The canonical path of that file, or empty. The file is active while
+    // forcing, so that a field which imports the file itself is reported
+    // as a recursive file reference.
+    Filesystem::path file_;
+
+    Thunk(Shared<const Operation>, System&, slot_t module_slot, slot_t nslots);
+
+    /// Run the setter, storing field values into module `m`.
+    void force(Module_Base& m);
+
+    virtual void print_repr(std::ostream&) const override;
+};
+
 /// A module value contains a set of name/value pairs, specified
 /// using a set of mutually recursive definitions.
 ///
@@ -50,6 +90,10 @@ struct Module_Base : public Record
     /// The number of slots is determined at compile time, and slot indexes are
     /// determined at compile time. Which slots contain Lambdas is also known
     /// at compile time.
+    ///
+    /// A slot may also contain a Thunk, for a field that has not been
+    /// evaluated yet. `get` forces the Thunk. The raw slot accessor `at`
+    /// does not, and is only used to initialize slots.
 
     Module_Base(Shared<Dictionary> dictionary)
     :
@@ -58,6 +102,7 @@ struct Module_Base : public Record
     {}
 
     /// Fetch the contents of slot index `i`, normalize to a proper Value.
+    /// May throw an Exception, if the slot contains a Thunk that fails.
     Value get(slot_t i) const;
 
     Value& at(slot_t i) { return array_[i]; }
@@ -94,6 +94,15 @@ Output_File::open()
     tempfile_ostream_.open(io::file_descriptor_sink(fd, io::close_handle));
 }
 
+std::ostream&
+Output_File::open_stream()
+{
+    if (path_.empty() && ostream_ != nullptr)
+        return *ostream_;
+    open();
+    return tempfile_ostream_;
+}
+
 const Filesystem::path&
 Output_File::path()
 {
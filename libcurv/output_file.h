@@ -54,6 +54,12 @@ struct Output_File
     std::ostream& ostream() { return tempfile_ostream_; }
     const Filesystem::path& path();
 
+    // For exporters that stream a large amount of data, such as video.
+    // If the client specified an output stream, it is returned, and data
+    // is written to it directly, without buffering it in a tempfile.
+    // Otherwise, this is equivalent to open() followed by ostream().
+    std::ostream& open_stream();
+
     // After the exporter has written all of the data, the client calls
     // commit(), which atomically updates the output file, or writes the
     // data to the output stream specified by the client. If commit() is
@@ -15,7 +15,7 @@
 namespace curv {
 
 const std::vector<const char*>
-Render_Opts::shader_enum { "standard", "pew", "sf1" };
+Render_Opts::shader_enum { "standard", "pew", "sf1", "heatmap" };
 
 void
 Render_Opts::set_shader(Value val, const Context& cx)
@@ -35,6 +35,13 @@ Render_Opts::set_shader(Value val, const Context& cx)
         }
         goto error;
     }
+    if (v.first == "heatmap") {
+        if (v.second.is_missing()) {
+            shader_ = Shader::heatmap;
+            return;
+        }
+        goto error;
+    }
     if (v.first == "sf1") {
         shader_ = Shader::sf1;
         if (!v.second.is_missing()) {
@@ -46,7 +53,30 @@ Render_Opts::set_shader(Value val, const Context& cx)
     }
 error:
     throw Exception(cx,
-        stringify(val," is not #standard|#pew|{sf1:<function>}"));
+        stringify(val," is not #standard|#pew|#heatmap|{sf1:<function>}"));
+}
+
+static double
+to_ray_precision(Value val, const Context& cx)
+{
+    if (auto sym = maybe_symbol(val)) {
+        if (sym == "pixel")
+            return Render_Opts::pixel_precision;
+    } else {
+        double precision = val.to_num_or_nan();
+        if (precision >= 0.0)
+            return precision;
+    }
+    throw Exception(cx, stringify(val, " is not a number >= 0 or #pixel"));
+}
+
+static double
+to_ray_relax(Value val, const Context& cx)
+{
+    double relax = val.to_num(cx);
+    if (relax >= 1.0 && relax < 2.0)
+        return relax;
+    throw Exception(cx, stringify(val, " is not in the range 1 <= n < 2"));
 }
 
 void
@@ -66,6 +96,10 @@ Render_Opts::update_from_record(
     if (!fdur_val.is_missing()) {
         fdur_ = fdur_val.to_num(At_Field("fdur", cx));
     }
+    auto ftarget_val = r.find_field(make_symbol("ftarget"), cx);
+    if (!ftarget_val.is_missing()) {
+        ftarget_ = ftarget_val.to_num(At_Field("ftarget", cx));
+    }
     auto bg_val = r.find_field(make_symbol("bg"), cx);
     if (!bg_val.is_missing()) {
         bg_ = value_to_vec3(bg_val, At_Field("bg", cx));
@@ -80,6 +114,16 @@ Render_Opts::update_from_record(
         ray_max_depth_ = ray_max_depth_val.to_num(
             At_Field("ray_max_depth", cx));
     }
+    auto ray_precision_val = r.find_field(make_symbol("ray_precision"), cx);
+    if (!ray_precision_val.is_missing()) {
+        ray_precision_ = to_ray_precision(ray_precision_val,
+            At_Field("ray_precision", cx));
+    }
+    auto ray_relax_val = r.find_field(make_symbol("ray_relax"), cx);
+    if (!ray_relax_val.is_missing()) {
+        ray_relax_ = to_ray_relax(ray_relax_val,
+            At_Field("ray_relax", cx));
+    }
     auto shader_val = r.find_field(make_symbol("shader"), cx);
     if (!shader_val.is_missing()) {
         set_shader(shader_val, At_Field("shader", cx));
@@ -98,6 +142,10 @@ Render_Opts::describe_opts(std::ostream& out, const char* prefix)
   << prefix <<
   "-O fdur=<frame duration, in seconds> : Used with -Otaa and -Oanimate\n"
   << prefix <<
+  "-O ftarget=<target frame duration while the view moves, in seconds>\n"
+  << prefix <<
+  "   (default " << opts.ftarget_ << ", 0 means full resolution always)\n"
+  << prefix <<
   "-O bg=<background colour>\n"
   << prefix <<
   "-O ray_max_iter=<maximum # of ray-march iterations> (default "
@@ -106,7 +154,11 @@ Render_Opts::describe_opts(std::ostream& out, const char* prefix)
   "-O ray_max_depth=<maximum ray-marching depth> (default "
     << opts.ray_max_depth_ << ")\n"
   << prefix <<
-  "-O shader=#standard|#pew|{sf1:<function>}\n"
+  "-O ray_precision=<hit tolerance, relative to ray length>|#pixel (default 0.0005)\n"
+  << prefix <<
+  "-O ray_relax=<sphere tracing over-relaxation, 1 to 2> (default 1)\n"
+  << prefix <<
+  "-O shader=#standard|#pew|#heatmap|{sf1:<function>}\n"
   ;
 }
 
@@ -125,6 +177,10 @@ Render_Opts::set_field(const std::string& name, Value val, const Context& cx)
         fdur_ = val.to_num(cx);
         return true;
     }
+    if (name == "ftarget") {
+        ftarget_ = val.to_num(cx);
+        return true;
+    }
     if (name == "bg") {
         bg_ = value_to_vec3(val, cx);
         return true;
@@ -137,6 +193,14 @@ Render_Opts::set_field(const std::string& name, Value val, const Context& cx)
         ray_max_depth_ = val.to_num(cx);
         return true;
     }
+    if (name == "ray_precision") {
+        ray_precision_ = to_ray_precision(val, cx);
+        return true;
+    }
+    if (name == "ray_relax") {
+        ray_relax_ = to_ray_relax(val, cx);
+        return true;
+    }
     if (name == "shader") {
         set_shader(val, cx);
         return true;
@@ -17,7 +17,7 @@ struct Function;
 
 struct Render_Opts
 {
-    enum class Shader { standard, pew, sf1 };
+    enum class Shader { standard, pew, sf1, heatmap };
     static const std::vector<const char*> shader_enum;
 
     // spatial anti-aliasing via supersampling. aa_==1 means it is turned off.
@@ -26,12 +26,27 @@ struct Render_Opts
     int taa_ = 1;
     // frame duration for animation, needed for TAA.
     double fdur_ = 0.04; // 25 FPS
+    // Target frame duration, in seconds, while the Viewer camera is moving.
+    // Frames are rendered at a reduced resolution chosen to meet the target,
+    // and without spatial anti-aliasing, until the view is idle.
+    // 0 disables adaptive resolution.
+    double ftarget_ = 1.0/30.0;
     // background colour, defaults to white
     glm::dvec3 bg_ = glm::dvec3(1.0,1.0,1.0);
     // max # of iterations in the ray-marcher
     int ray_max_iter_ = 200000000;
     // max ray-marching distance
     double ray_max_depth_ = 4000.0;
+    // A ray hits the surface when the distance is less than
+    // ray_precision_ times the distance along the ray: the radius of a cone
+    // around the ray. 0 means use the renderer's default. pixel_precision,
+    // configured as ray_precision=#pixel, sizes the cone to half an AA
+    // sample, in renderers that draw pixels.
+    double ray_precision_ = 0.0;
+    static constexpr double pixel_precision = -1.0;
+    // Over-relaxation factor for sphere tracing, in the range [1,2).
+    // 1 means plain sphere tracing.
+    double ray_relax_ = 1.0;
     // shader implementation
     Shader shader_ = Shader::standard;
     // sf1 shader function, configured as: shader={sf1:<function>}
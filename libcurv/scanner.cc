@@ -16,23 +16,54 @@ bool is_dollar_next_char(char c)
     return c=='_' || c=='(' || c=='[' || c=='{' || isalpha(c);
 }
 
-void
-Scanner::push_token(Token tok)
+// Classify an unquoted identifier as a keyword or k_ident.
+// Dispatch on the first character, so that most identifiers are
+// rejected after at most a couple of string comparisons.
+static Token::Kind
+keyword_kind(Range<const char*> id)
 {
-    //cerr << "push_token " << tok << "\n";
-    lookahead_.push_back(tok);
+    switch (id[0]) {
+    case 'b':
+        if (id == "by") return Token::k_by;
+        break;
+    case 'd':
+        if (id == "do") return Token::k_do;
+        break;
+    case 'e':
+        if (id == "else") return Token::k_else;
+        break;
+    case 'f':
+        if (id == "for") return Token::k_for;
+        break;
+    case 'i':
+        if (id == "if") return Token::k_if;
+        if (id == "in") return Token::k_in;
+        if (id == "include") return Token::k_include;
+        break;
+    case 'l':
+        if (id == "let") return Token::k_let;
+        if (id == "local") return Token::k_local;
+        break;
+    case 'p':
+        if (id == "parametric") return Token::k_parametric;
+        break;
+    case 't':
+        if (id == "test") return Token::k_test;
+        break;
+    case 'v':
+        if (id == "var") return Token::k_var;
+        break;
+    case 'w':
+        if (id == "where") return Token::k_where;
+        if (id == "while") return Token::k_while;
+        break;
+    }
+    return Token::k_ident;
 }
 
 Token
-Scanner::get_token()
+Scanner::scan_token()
 {
-    if (!lookahead_.empty()) {
-        auto tok = lookahead_.back();
-        lookahead_.pop_back();
-        //cerr << "get_token from lookahead" << tok << "\n";
-        return tok;
-    }
-
     Token tok;
     const char* p = ptr_;
     const char* first = source_->first;
@@ -235,36 +266,7 @@ Scanner::get_token()
         while (p < last && (isalnum(*p) || *p == '_'))
             ++p;
         Range<const char*> id(first+tok.first_, p);
-        if (id == "by")
-            tok.kind_ = Token::k_by;
-        else if (id == "do")
-            tok.kind_ = Token::k_do;
-        else if (id == "else")
-            tok.kind_ = Token::k_else;
-        else if (id == "for")
-            tok.kind_ = Token::k_for;
-        else if (id == "if")
-            tok.kind_ = Token::k_if;
-        else if (id == "in")
-            tok.kind_ = Token::k_in;
-        else if (id == "include")
-            tok.kind_ = Token::k_include;
-        else if (id == "let")
-            tok.kind_ = Token::k_let;
-        else if (id == "local")
-            tok.kind_ = Token::k_local;
-        else if (id == "parametric")
-            tok.kind_ = Token::k_parametric;
-        else if (id == "test")
-            tok.kind_ = Token::k_test;
-        else if (id == "var")
-            tok.kind_ = Token::k_var;
-        else if (id == "where")
-            tok.kind_ = Token::k_where;
-        else if (id == "while")
-            tok.kind_ = Token::k_while;
-        else
-            tok.kind_ = Token::k_ident;
+        tok.kind_ = keyword_kind(id);
         goto success;
     }
 
@@ -27,6 +27,10 @@ struct Scanner_Opts
 /// get_token() gets the next token.
 /// push_token() pushes back a previously got token,
 /// supporting infinite lookahead.
+///
+/// The recursive descent parser peeks at each token several times (once per
+/// precedence level), so the lookahead fast path is inline, and only
+/// scan_token() does the work of recognizing a fresh token.
 struct Scanner
 {
     Shared<const Source> source_;
@@ -47,9 +51,23 @@ struct Scanner
         string_begin_(),
         ptr_(source_->begin() + opts.skip_prefix_),
         lookahead_()
-    {}
-    Token get_token();
-    void push_token(Token);
+    {
+        lookahead_.reserve(8);
+    }
+    Token get_token()
+    {
+        if (!lookahead_.empty()) {
+            auto tok = lookahead_.back();
+            lookahead_.pop_back();
+            return tok;
+        }
+        return scan_token();
+    }
+    void push_token(Token tok)
+    {
+        lookahead_.push_back(tok);
+    }
+    Token scan_token();
 };
 
 } // namespace curv
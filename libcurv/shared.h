@@ -10,6 +10,7 @@
 #include <cstdlib>
 #include <memory>
 #include <new>
+#include <utility>
 
 namespace curv {
 
@@ -25,12 +26,12 @@ struct Shared : public boost::intrusive_ptr<T>
     Shared(T*p) : boost::intrusive_ptr<T>(p) {}
     Shared(const Shared& r) : boost::intrusive_ptr<T>(r) {}
     template<class Y> Shared(Shared<Y> const& r) : boost::intrusive_ptr<T>(r) {}
-    Shared(Shared&& rhs) noexcept : boost::intrusive_ptr<T>(rhs) {}
+    Shared(Shared&& rhs) noexcept : boost::intrusive_ptr<T>(std::move(rhs)) {}
 
     // restating move constructor requires restatement of assignment ops
     Shared& operator=(Shared&& rhs) noexcept
     {
-        boost::intrusive_ptr<T>::operator=(rhs);
+        boost::intrusive_ptr<T>::operator=(std::move(rhs));
         return *this;
     }
     Shared& operator=(Shared const& rhs)
@@ -11,15 +11,14 @@
 #include <cerrno>
 #include <cstring>
 #include <fstream>
-#include <sstream>
 
 namespace curv
 {
 
 Shared<const String> readfile(const char* path, const Context& ctx)
 {
-    // TODO: Cache multiple references to the same file. Where does the cache
-    // go? System or Session object.
+    // Multiple references to the same Curv source file are cached by
+    // curv_import, in System::import_cache_, so files aren't cached here.
 
     // TODO: Pluggable file system abstraction, for unit testing and
     // abstracting the behaviour of `file` (would also support caching).
@@ -53,9 +52,11 @@ Shared<const String> readfile(const char* path, const Context& ctx)
     if (t.fail())
         throw Exception(ctx,
             stringify("\"", path, "\": ", strerror(errno)));
-    std::stringstream buffer;
+    // Read straight into the String that we return, without going through
+    // an intermediate std::stringstream and std::string.
+    String_Builder buffer;
     buffer << t.rdbuf();
-    return make_string(buffer.str());
+    return buffer.get_string();
 }
 
 File_Source::File_Source(String_Ref filename, const Context& ctx)
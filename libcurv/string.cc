@@ -6,6 +6,9 @@
 #include <libcurv/list.h>
 #include <libcurv/exception.h>
 
+#include <algorithm>
+#include <climits>
+
 namespace curv {
 
 bool is_string(Value val)
@@ -55,18 +58,119 @@ to_print_string(Value val)
     return sb.get_string();
 }
 
+void
+String_Base::reserve(Shared<String>& str, size_t cap)
+{
+    size_t size = str ? str->size() : 0;
+    if (str && str->use_count == 1 && cap <= str->capacity())
+        return;
+    size_t newcap = std::max(cap, 2*size);
+    auto r = String::make(newcap);
+    if (size > 0)
+        memcpy(r->data_, str->data_, size);
+    r->resize(size);
+    str = r;
+}
+
+void
+String_Base::append(Shared<String>& str, const char* data, size_t len)
+{
+    size_t size = str ? str->size() : 0;
+    reserve(str, size + len);
+    memcpy(str->data_ + size, data, len);
+    str->resize(size + len);
+}
+
+size_t
+String_Streambuf::size() const noexcept
+{
+    if (pbase() != nullptr)
+        return pptr() - pbase();
+    return string_ ? string_->size() : 0;
+}
+
+const char*
+String_Streambuf::data() const noexcept
+{
+    return string_ ? string_->data() : "";
+}
+
+// Move the characters in the put area into string_->size().
+void
+String_Streambuf::sync_size()
+{
+    if (pbase() != nullptr) {
+        string_->resize(pptr() - pbase());
+        setp(nullptr, nullptr);
+    }
+}
+
+// Ensure there is room in the put area for 'extra' more characters.
+void
+String_Streambuf::reserve(size_t extra)
+{
+    sync_size();
+    size_t size = string_ ? string_->size() : 0;
+    String_Base::reserve(string_, size + std::max(extra, size_t(32)));
+    char* p = string_->data_;
+    setp(p, p + string_->capacity());
+    // pbump takes an int, so advance in steps for very large strings.
+    while (size > 0) {
+        int n = int(std::min(size, size_t(INT_MAX)));
+        pbump(n);
+        size -= n;
+    }
+}
+
+String_Streambuf::int_type
+String_Streambuf::overflow(int_type c)
+{
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+        return traits_type::not_eof(c);
+    reserve(1);
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+    return c;
+}
+
+std::streamsize
+String_Streambuf::xsputn(const char* s, std::streamsize n)
+{
+    if (n <= 0)
+        return 0;
+    if (epptr() - pptr() < n)
+        reserve(size_t(n));
+    size_t len = size_t(n);
+    memcpy(pptr(), s, len);
+    while (len > 0) {
+        int k = int(std::min(len, size_t(INT_MAX)));
+        pbump(k);
+        len -= k;
+    }
+    return n;
+}
+
+Shared<String>
+String_Streambuf::get_string()
+{
+    sync_size();
+    if (string_ == nullptr)
+        string_ = make_string(size_t(0));
+    return string_;
+}
+
 Shared<String>
 String_Builder::get_string()
 {
-    auto s = str(); // copies the data
-    return make_string(s.data(), s.size()); // copies the data again
+    flush();
+    return String_Streambuf::get_string();
 }
 Value
 String_Builder::get_value()
 {
-    auto s = str(); // copies the data
-    if (s.empty()) return {List::make(0)};
-    return {make_string(s.data(), s.size())}; // copies the data again
+    flush();
+    if (String_Streambuf::size() == 0) return {List::make(0)};
+    return {String_Streambuf::get_string()};
 }
 
 void
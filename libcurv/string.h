@@ -11,6 +11,8 @@
 #include <libcurv/value.h>
 #include <sstream>
 #include <cstring>
+#include <streambuf>
+#include <string>
 
 namespace curv {
 
@@ -97,6 +99,35 @@ struct String_Base : public Abstract_List
     {
         return Value{data_[i]};
     }
+
+    // Number of characters allocated, including spare capacity past size().
+    size_t capacity() const noexcept
+      { return capacity_ > size_ ? capacity_ : size_; }
+
+    // Ensure that 'str' (nullptr denotes the empty string) has room for at
+    // least 'cap' characters. If 'str' holds the only reference to the
+    // string, and it is big enough, then nothing changes. Otherwise 'str' is
+    // replaced by a copy, and the capacity is at least doubled, so that a
+    // sequence of appends runs in amortized linear time.
+    static void reserve(Shared<String>& str, size_t cap);
+
+    // Append characters to 'str'. Like reserve(), the string is extended
+    // in place if 'str' holds the only reference.
+    static void append(Shared<String>& str, const char*, size_t);
+
+    // Set the length of a uniquely referenced string, after characters
+    // have been written in place. Requires len <= capacity().
+    void resize(size_t len) noexcept
+    {
+        capacity_ = capacity();
+        size_ = len;
+        data_[len] = '\0';
+    }
+protected:
+    // Allocated character count, if it exceeds size_.
+    // Only reserve() creates spare capacity.
+    size_t capacity_ = 0;
+public:
     char data_[1];
 };
 
@@ -190,15 +221,46 @@ struct String_Ref : public Shared<const String>
     operator const char*() { return (*this)->c_str(); }
 };
 
+/// The stream buffer used by String_Builder.
+///
+/// Characters are written directly into the storage of a curv::String.
+/// The put area is the spare capacity of that string.
+struct String_Streambuf : public std::streambuf
+{
+    size_t size() const noexcept;
+    const char* data() const noexcept;
+
+    // Hand over the string buffer. The builder keeps a reference, and
+    // subsequent writes are copy on write.
+    Shared<String> get_string();
+protected:
+    virtual int_type overflow(int_type) override;
+    virtual std::streamsize xsputn(const char*, std::streamsize) override;
+private:
+    // Characters written so far. If there is a put area, it begins at
+    // string_->data_, and string_->size() is not yet up to date.
+    Shared<String> string_ = nullptr;
+    void sync_size();
+    void reserve(size_t extra);
+};
+
 /// Factory class for building a curv::String using ostream operations.
-struct String_Builder : public std::stringstream
+///
+/// get_string() and get_value() return the internal buffer without copying
+/// it, so generating a large text output (eg, with `repr`) is linear time.
+struct String_Builder : private String_Streambuf, public std::ostream
 {
-    // An optimized version of this class would use a curv::String
-    // as the internal string buffer.
+    String_Builder() : String_Streambuf(), std::ostream(this) {}
 
     Shared<String> get_string();
     Value get_value();
 
+    // Copy the contents to a std::string.
+    std::string str() const
+    {
+        return std::string(String_Streambuf::data(), String_Streambuf::size());
+    }
+
     // variadic function that appends each argument to the string buffer
     template<typename First, typename... Rest>
     void write_all(First&& first, Rest&&... rest)
@@ -224,67 +286,67 @@ operator<<(String_Builder& b, double n)
 inline String_Builder&
 operator<<(String_Builder& b, long long n)
 {
-    (std::stringstream&)b << n;
+    (std::ostream&)b << n;
     return b;
 }
 inline String_Builder&
 operator<<(String_Builder& b, unsigned long long n)
 {
-    (std::stringstream&)b << n;
+    (std::ostream&)b << n;
     return b;
 }
 inline String_Builder&
 operator<<(String_Builder& b, long n)
 {
-    (std::stringstream&)b << n;
+    (std::ostream&)b << n;
     return b;
 }
 inline String_Builder&
 operator<<(String_Builder& b, unsigned long n)
 {
-    (std::stringstream&)b << n;
+    (std::ostream&)b << n;
     return b;
 }
 inline String_Builder&
 operator<<(String_Builder& b, int n)
 {
-    (std::stringstream&)b << n;
+    (std::ostream&)b << n;
     return b;
 }
 inline String_Builder&
 operator<<(String_Builder& b, unsigned n)
 {
-    (std::stringstream&)b << n;
+    (std::ostream&)b << n;
     return b;
 }
 inline String_Builder&
 operator<<(String_Builder& b, short n)
 {
-    (std::stringstream&)b << n;
+    (std::ostream&)b << n;
     return b;
 }
 inline String_Builder&
 operator<<(String_Builder& b, unsigned short n)
 {
-    (std::stringstream&)b << n;
+    (std::ostream&)b << n;
     return b;
 }
 inline String_Builder&
 operator<<(String_Builder& b, char c)
 {
-    (std::stringstream&)b << c;
+    (std::ostream&)b << c;
     return b;
 }
 inline String_Builder&
 operator<<(String_Builder& b, signed char c)
 {
-    (std::stringstream&)b << c;
+    (std::ostream&)b << c;
     return b;
 }
 inline String_Builder&
 operator<<(String_Builder& b, unsigned char c)
 {
-    (std::stringstream&)b << c;
+    (std::ostream&)b << c;
     return b;
 }
 
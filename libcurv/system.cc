@@ -96,8 +96,8 @@ void System_Impl::load_library(String_Ref path)
     prog.compile();
     auto stdlib = prog.eval();
     auto m = stdlib.to<Module>(At_Phrase(*prog.phrase_, *this, nullptr));
-    for (auto b : *m)
-        std_namespace_[b.first] = make<Builtin_Value>(b.second);
+    for (auto b : *m->dictionary_)
+        std_namespace_[b.first] = make<Builtin_Module_Field>(m, b.second);
 }
 
 const Namespace& System_Impl::std_namespace()
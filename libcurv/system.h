@@ -5,7 +5,9 @@
 #ifndef LIBCURV_SYSTEM_H
 #define LIBCURV_SYSTEM_H
 
+#include <cstdint>
 #include <ostream>
+#include <unordered_map>
 #include <unordered_set>
 #include <map>
 #include <libcurv/filesystem.h>
@@ -15,6 +17,41 @@ namespace curv {
 
 struct Context;
 
+/// Identifies a version of a file: used to validate cached imports.
+/// See get_file_stamp and file_is_current.
+struct File_Stamp
+{
+    std::int64_t mtime_ = 0;    // nanoseconds, since the file clock's epoch
+    std::uintmax_t size_ = 0;
+    bool hashed_ = false;       // true if the mtime was too recent to trust
+    std::size_t hash_ = 0;      // hash of the contents, if hashed_
+
+    bool operator==(const File_Stamp& s) const
+    {
+        return mtime_ == s.mtime_ && size_ == s.size_
+            && hashed_ == s.hashed_ && hash_ == s.hash_;
+    }
+    bool operator!=(const File_Stamp& s) const { return !(*this == s); }
+};
+
+/// The files that an imported value depends on: the files and directories
+/// imported while it was being evaluated, or later, while lazily evaluating
+/// parts of it (see Thunk and Dir_Record).
+struct Import_Deps : public Shared_Base
+{
+    std::map<Filesystem::path, File_Stamp> files_;
+    // The canonical path of the imported file, or empty.
+    Filesystem::path file_;
+};
+
+/// A Curv source file that has been imported by `file`.
+struct Import_Cache_Entry
+{
+    File_Stamp stamp_;
+    Value value_;
+    Shared<Import_Deps> deps_;
+};
+
 /// An abstract interface to the client and operating system.
 ///
 /// The System object is owned by the client, who is responsible for ensuring
@@ -58,10 +95,18 @@ struct System
 
     // This is non-empty while a `file` operation is being evaluated.
     // It is used to detect recursive file references.
-    // Later, this may change to a file cache.
-    // Or, it could move into the Program structure.
     std::unordered_set<Filesystem::path,Path_Hash> active_files_{};
 
+    // The values of Curv source files imported by `file`, keyed on canonical
+    // path. An entry is reused while the file, and each file it depends on,
+    // has the same mtime and size as when it was imported. The cache lives
+    // as long as the System, so live mode only re-evaluates changed files.
+    std::unordered_map<Filesystem::path,Import_Cache_Entry,Path_Hash>
+        import_cache_{};
+
+    // Collects the dependencies of the import being evaluated, or nullptr.
+    Shared<Import_Deps> import_deps_ = nullptr;
+
     // Used by `file` to import a file based on its extension.
     // The extension includes the leading '.', and "" means no extension.
     // The extension is converted to lowercase on all platforms.
@@ -89,6 +134,24 @@ struct Active_File
     }
 };
 
+// RAII helper class, for use with System::import_deps_.
+struct Current_Import_Deps
+{
+    Shared<Import_Deps>& current_;
+    Shared<Import_Deps> saved_;
+    Current_Import_Deps(System& sys, Shared<Import_Deps> deps)
+    :
+        current_(sys.import_deps_),
+        saved_(sys.import_deps_)
+    {
+        current_ = deps;
+    }
+    ~Current_Import_Deps()
+    {
+        current_ = saved_;
+    }
+};
+
 /// Default implementation of the System interface.
 struct System_Impl : public System
 {
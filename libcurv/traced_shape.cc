@@ -130,31 +130,53 @@ static const char* DEFAULT_CAST_RAY =
        "{\n"
        "    float tmin = 0.02;\n" // was 1.0
        "    float tmax = ray_max_depth;\n"
+       "    float3 c = (float3)(-1.0,-1.0,-1.0);\n"
        "   \n"
-       // TODO: implement bounding volume. If I remove the 'if(t>tmax)break'
-       // check, then `tetrahedron` breaks. The hard coded tmax=200 fails for
-       // some models.
-       //"#if 0\n"
-       //"    // bounding volume\n"
-       //"    float tp1 = (0.0-ro.y)/rd.y; if( tp1>0.0 ) tmax = min( tmax, tp1 );\n"
-       //"    float tp2 = (1.6-ro.y)/rd.y; if( tp2>0.0 ) { if( ro.y>1.6 ) tmin = max( tmin, tp2 );\n"
-       //"                                                 else           tmax = min( tmax, tp2 ); }\n"
-       //"#endif\n"
-       //"    \n"
+       // Clip the ray to the bounding box (slab method). See frag.cc.
+       "#ifdef BBOX_CLIP\n"
+       "    float3 pad = (bbox_max - bbox_min)*0.001f + 0.001f;\n"
+       "    float3 rinv = 1.0f/rd;\n"
+       "    float3 t0 = (bbox_min - pad - ro)*rinv;\n"
+       "    float3 t1 = (bbox_max + pad - ro)*rinv;\n"
+       "    float3 tlo = fmin(t0,t1);\n"
+       "    float3 thi = fmax(t0,t1);\n"
+       "    tmin = fmax(tmin, fmax(tlo.x, fmax(tlo.y, tlo.z)));\n"
+       "    tmax = fmin(tmax, fmin(thi.x, fmin(thi.y, thi.z)));\n"
+       "    if (tmin > tmax) return (float4)( ray_max_depth, c );\n"
+       "#endif\n"
        "    float t = tmin;\n"
-       "    float3 c = (float3)(-1.0,-1.0,-1.0);\n"
+       "#ifdef RAY_RELAX\n"
+       "    float omega = RAY_RELAX;\n"
+       "    float prev_d = 0.0f;\n"
+       "    float stride = 0.0f;\n"
+       "#endif\n"
        "    for (int i=0; i<ray_max_iter; i++) {\n"
-       "        float precis = 0.00001*t;\n"
+       "        float precis = ray_precision*t;\n"
        "        float4 p = (float4)(ro+rd*t,time);\n"
        "        float d = dist(p);\n"
        "        if (isinside > 0) {\n"
        "            d = -d;\n"
        "        }\n"
+       // Over-relaxed sphere tracing. See frag.cc.
+       "#ifdef RAY_RELAX\n"
+       "        if (omega > 1.0f && fabs(d) + prev_d < stride) {\n"
+       "            t += prev_d - stride;\n"
+       "            stride = prev_d;\n"
+       "            omega = 1.0f;\n"
+       "            continue;\n"
+       "        }\n"
+       "#endif\n"
        "        if (d < precis) {\n"
        "            c = colour(p);\n"
        "            break;\n"
        "        }\n"
+       "#ifdef RAY_RELAX\n"
+       "        prev_d = fabs(d);\n"
+       "        stride = fabs(d)*omega;\n"
+       "        t += stride;\n"
+       "#else\n"
        "        t += fabs(d);\n"
+       "#endif\n"
        "        if (t > tmax) break;\n"
        "    }\n"
        "    return (float4)( t, c );\n"
@@ -237,16 +259,20 @@ static const char* DEFAULT_IS_INSIDE =
 
 static const std::vector<std::tuple<std::string, Traced_Shape::VarType, bool, cl_mem_flags>>
     DEFAULT_KERNEL_PARAMETER=
-                    { {"io", Traced_Shape::VarType::FLOAT3, true, CL_MEM_READ_ONLY},
-                      {"id", Traced_Shape::VarType::FLOAT3, true, CL_MEM_READ_ONLY},
-                      {"ivalid", Traced_Shape::VarType::INT, true, CL_MEM_READ_ONLY},
-                      {"indRatio", Traced_Shape::VarType::FLOAT, true, CL_MEM_READ_ONLY},
+                    //The incident and reflected ray buffers are swapped on the
+                    //device between iterations, so they are all read/write.
+                    { {"io", Traced_Shape::VarType::FLOAT3, true, CL_MEM_READ_WRITE},
+                      {"id", Traced_Shape::VarType::FLOAT3, true, CL_MEM_READ_WRITE},
+                      {"ivalid", Traced_Shape::VarType::INT, true, CL_MEM_READ_WRITE},
+                      {"indRatio", Traced_Shape::VarType::FLOAT, true, CL_MEM_READ_WRITE},
                       {"time", Traced_Shape::VarType::FLOAT, false, CL_MEM_READ_ONLY},
-                      {"ro", Traced_Shape::VarType::FLOAT3, true, CL_MEM_WRITE_ONLY},
-                      {"rd", Traced_Shape::VarType::FLOAT3, true, CL_MEM_WRITE_ONLY},
+                      {"ro", Traced_Shape::VarType::FLOAT3, true, CL_MEM_READ_WRITE},
+                      {"rd", Traced_Shape::VarType::FLOAT3, true, CL_MEM_READ_WRITE},
                       {"rvalid", Traced_Shape::VarType::INT, true, CL_MEM_READ_WRITE},
                       {"normal", Traced_Shape::VarType::FLOAT3, true, CL_MEM_WRITE_ONLY},
-                      {"isinside", Traced_Shape::VarType::INT, true, CL_MEM_READ_WRITE}};
+                      {"isinside", Traced_Shape::VarType::INT, true, CL_MEM_READ_WRITE},
+                      {"segs", Traced_Shape::VarType::FLOAT4, true, CL_MEM_WRITE_ONLY},
+                      {"counts", Traced_Shape::VarType::INT, true, CL_MEM_READ_WRITE}};
 
 
 static const char* DEFAULT_RAY_TRACE =
@@ -259,8 +285,12 @@ static const char* DEFAULT_RAY_TRACE =
                     "              __global float3* rd,\n" //Reflected/refracted ray direction.
                     "              __global int* rvalid,\n" //Reflected/refracted ray valid.
                     "              __global float3* normal,\n" //Normal of reflected/refracted ray.
-                    "              __global int* isinside) {\n" //Is incident ray from inside of the solid.
+                    "              __global int* isinside,\n" //Is incident ray from inside of the solid.
+                    "              __global float4* segs,\n" //Output ray segments: origin, direction, colour.
+                    "              __global int* counts,\n" //Number of segments, number of valid reflected rays.
+                    "              uint n) {\n" //Number of rays; the global size is padded.
                     "    uint gid = get_global_id(0);\n"
+                    "    if (gid >= n) return;\n"
                     "    if (ivalid[gid] == 0) {\n"
                     "        rd[gid] = (float3)(0, 0, 0);\n"
                     "        ro[gid] = (float3)(0, 0, 0);\n"
@@ -296,26 +326,102 @@ static const char* DEFAULT_RAY_TRACE =
                     "            }\n"
                     "            normal[gid] = norm;\n"
                     "        }\n"
+                    "        int s = 3 * atomic_add(&counts[0], 2);\n"
+                    "        segs[s] = (float4)(io[gid], 0.0);\n"
+                    "        segs[s+1] = (float4)(pos - io[gid], 0.0);\n"
+                    "        segs[s+2] = isinside[gid] ? (float4)(0.0, 0.0, 1.0, 1.0)\n"
+                    "                                  : (float4)(0.0, 1.0, 1.0, 1.0);\n"
+                    "        segs[s+3] = (float4)(pos, 0.0);\n"
+                    "        if (rvalid[gid]) {\n"
+                    "            atomic_inc(&counts[1]);\n"
+                    "            segs[s+4] = (float4)(normal[gid] * 0.1f, 0.0);\n"
+                    "            segs[s+5] = (float4)(0.0, 1.0, 0.0, 1.0);\n"
+                    "        } else {\n"
+                    "            segs[s+4] = (float4)(rd[gid] * 10000.0f, 0.0);\n"
+                    "            segs[s+5] = (float4)(1.0, 0.0, 0.0, 1.0);\n"
+                    "        }\n"
                     "    }\n"
                     "}\n"
                     "\n";
 
+//Stream compaction of the rays that survive an iteration, so that the next
+//iteration only runs over live rays. An exclusive prefix sum of rvalid gives
+//each surviving ray its packed index: scan_groups scans within each work
+//group, scan_sums scans the group totals, and compact scatters the reflected
+//rays into the incident ray buffers. scan_groups and compact must be run
+//with the same local size, and scan_groups needs that many ints of local
+//memory for `tmp`.
+static const char* DEFAULT_RAY_COMPACT =
+                    "__kernel void scan_groups(__global const int* rvalid,\n"
+                    "                          __global int* offsets,\n" //Exclusive scan within the group.
+                    "                          __global int* groupSums,\n" //Number of live rays of each group.
+                    "                          __local int* tmp,\n"
+                    "                          uint n) {\n"
+                    "    uint gid = get_global_id(0);\n"
+                    "    uint lid = get_local_id(0);\n"
+                    "    uint size = get_local_size(0);\n"
+                    "    int v = gid < n ? rvalid[gid] : 0;\n"
+                    "    tmp[lid] = v;\n"
+                    "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+                    "    for (uint off = 1; off < size; off <<= 1) {\n"
+                    "        int t = lid >= off ? tmp[lid - off] : 0;\n"
+                    "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+                    "        tmp[lid] += t;\n"
+                    "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+                    "    }\n"
+                    "    if (gid < n) offsets[gid] = tmp[lid] - v;\n"
+                    "    if (lid == size - 1) groupSums[get_group_id(0)] = tmp[lid];\n"
+                    "}\n"
+                    "\n"
+                    "__kernel void scan_sums(__global int* groupSums, uint ngroups) {\n"
+                    "    int sum = 0;\n"
+                    "    for (uint g = 0; g < ngroups; g++) {\n"
+                    "        int t = groupSums[g];\n"
+                    "        groupSums[g] = sum;\n"
+                    "        sum += t;\n"
+                    "    }\n"
+                    "}\n"
+                    "\n"
+                    "__kernel void compact(__global const int* rvalid,\n"
+                    "                      __global const int* offsets,\n"
+                    "                      __global const int* groupSums,\n"
+                    "                      __global const float3* ro,\n"
+                    "                      __global const float3* rd,\n"
+                    "                      __global const float* indRatio,\n"
+                    "                      __global float3* io,\n"
+                    "                      __global float3* id,\n"
+                    "                      __global int* ivalid,\n"
+                    "                      __global float* nextIndRatio,\n"
+                    "                      uint n) {\n"
+                    "    uint gid = get_global_id(0);\n"
+                    "    if (gid >= n || rvalid[gid] == 0) return;\n"
+                    "    int k = groupSums[get_group_id(0)] + offsets[gid];\n"
+                    "    io[k] = ro[gid];\n"
+                    "    id[k] = rd[gid];\n"
+                    "    ivalid[k] = 1;\n"
+                    "    nextIndRatio[k] = indRatio[gid];\n"
+                    "}\n"
+                    "\n";
+
 static const std::vector<std::tuple<std::string, Traced_Shape::VarType, bool, cl_mem_flags>>
     DEFAULT_RAY_INIT_PARAMETER=
+                    //io, id and indRatio are shared with the ray calculation kernel.
                     { {"i", Traced_Shape::VarType::FLOAT3, true, CL_MEM_READ_ONLY},
-                      {"io", Traced_Shape::VarType::FLOAT3, true, CL_MEM_WRITE_ONLY},
-                      {"id", Traced_Shape::VarType::FLOAT3, true, CL_MEM_WRITE_ONLY},
+                      {"io", Traced_Shape::VarType::FLOAT3, true, CL_MEM_READ_WRITE},
+                      {"id", Traced_Shape::VarType::FLOAT3, true, CL_MEM_READ_WRITE},
                       {"ic", Traced_Shape::VarType::FLOAT4, true, CL_MEM_WRITE_ONLY},
-                      {"indRatio", Traced_Shape::VarType::FLOAT, true, CL_MEM_WRITE_ONLY}};
+                      {"indRatio", Traced_Shape::VarType::FLOAT, true, CL_MEM_READ_WRITE}};
 
 static const char* DEFAULT_RAY_INIT =
                     "__kernel void init_main(__global float3* i,\n" //The only variable to input to functions generating initial ray values.
                     "                   __global float3* io,\n" //Initial ray origin.
                     "                   __global float3* id,\n" //Initial ray direction.
                     "                   __global float3* ic,\n" //Initial ray colour.
-                    "                   __global float* indRatio\n" //Initial ray index or reflection.
+                    "                   __global float* indRatio,\n" //Initial ray index or reflection.
+                    "                   uint n\n" //Number of rays; the global size is padded.
                     "                   ) {\n"
                     "    uint gid = get_global_id(0);\n"
+                    "    if (gid >= n) return;\n"
                     "    io[gid] = rays_origin(i[gid]);\n"
                     "    id[gid] = rays_direction(i[gid]);\n"
                     "    ic[gid] = rays_colour(i[gid]);\n"
@@ -325,11 +431,15 @@ static const char* DEFAULT_RAY_INIT =
 
 static const char* DEFAULT_RAY_CALC_KERNEL_NAME = "main";
 static const char* DEFAULT_INIT_RAY__KERNEL_NAME = "init_main";
+static const char* DEFAULT_SCAN_GROUPS_KERNEL_NAME = "scan_groups";
+static const char* DEFAULT_SCAN_SUMS_KERNEL_NAME = "scan_sums";
+static const char* DEFAULT_COMPACT_KERNEL_NAME = "compact";
 
 //Required shader functions: dist, calcNormal, castRay, colour
-//Required shader constant: ray_max_iter, ray_max_depth
+//Required shader constant: ray_max_iter, ray_max_depth, ray_precision
 //Ray trace -> Get normal -> Bound check -> Refraction -> Ray trace
 
+void export_ray_march_opts(const Render_Opts& opts, std::ostream& out);
 void export_clprog_2d(const Shape_Program& shape, const Render_Opts& opts, std::ostream& out);
 void export_clprog_3d(const Shape_Program& shape, const Render_Opts& opts, std::ostream& out);
 void export_rays_clprog_2d(const Rays_Program& rays, const Render_Opts& opts, std::ostream& out);
@@ -376,6 +486,17 @@ void opencl_ray_init_function_export(const Rays_Program& rays, std::ostream& out
 
 }
 
+void export_ray_march_opts(const Render_Opts& opts, std::ostream& out)
+{
+    // The OpenCL tracer uses a tighter default precision than frag.cc.
+    // Its rays don't come from pixels, so #pixel also gets the default.
+    double precision =
+        opts.ray_precision_ > 0.0 ? opts.ray_precision_ : 0.00001;
+    out << "const float ray_precision = " << dfmt(precision, dfmt::EXPR) << ";\n";
+    if (opts.ray_relax_ > 1.0)
+        out << "#define RAY_RELAX " << dfmt(opts.ray_relax_, dfmt::EXPR) << "f\n";
+}
+
 void export_clprog(const Shape_Program& shape, const Render_Opts& opts, std::ostream& out)
 {
     if (shape.is_2d_)
@@ -437,6 +558,7 @@ void export_clprog_2d(const Shape_Program& shape, const Render_Opts& opts, std::
     out <<
         "const int ray_max_iter = " << opts.ray_max_iter_ << ";\n"
         "const float ray_max_depth = " << dfmt(opts.ray_max_depth_, dfmt::EXPR) << ";\n";
+    export_ray_march_opts(opts, out);
 
     out <<
         DEFAULT_REFLECT
@@ -467,7 +589,9 @@ void export_clprog_2d(const Shape_Program& shape, const Render_Opts& opts, std::
         <<
         DEFAULT_CALC_NORMAL_2D
         <<
-        DEFAULT_RAY_TRACE;
+        DEFAULT_RAY_TRACE
+        <<
+        DEFAULT_RAY_COMPACT;
 
 }
 
@@ -484,6 +608,7 @@ void export_clprog_3d(const Shape_Program& shape, const Render_Opts& opts, std::
     out <<
         "const int ray_max_iter = " << opts.ray_max_iter_ << ";\n"
         "const float ray_max_depth = " << dfmt(opts.ray_max_depth_, dfmt::EXPR) << ";\n";
+    export_ray_march_opts(opts, out);
 
     out <<
         DEFAULT_REFLECT
@@ -510,7 +635,8 @@ void export_clprog_3d(const Shape_Program& shape, const Render_Opts& opts, std::
             << dfmt(bbox.xmax, dfmt::EXPR) << ","
             << dfmt(bbox.ymax, dfmt::EXPR) << ","
             << dfmt(bbox.zmax, dfmt::EXPR)
-            << ");\n";
+            << ");\n"
+        << "#define BBOX_CLIP\n";
     }
 
     out <<
@@ -520,7 +646,9 @@ void export_clprog_3d(const Shape_Program& shape, const Render_Opts& opts, std::
         <<
         DEFAULT_CALC_NORMAL
         <<
-        DEFAULT_RAY_TRACE;
+        DEFAULT_RAY_TRACE
+        <<
+        DEFAULT_RAY_COMPACT;
 
 }
 
@@ -559,57 +687,67 @@ void Traced_Shape::setInitBuffers() {
     setInitBuffers(numRays_);
 }
 
-void Traced_Shape::setInitBuffers(std::tuple<unsigned int, unsigned int, unsigned int> numRays) {
-    //clear  argument data.
-    argsData_.clear();
-
-    unsigned int totalRays = std::get<0>(numRays) * std::get<1>(numRays) * std::get<2>(numRays);
-
-    //Allocate space for data.
+void Traced_Shape::RayBatch::resize(unsigned int numRays) {
     cl_float3 zerofl;
     zerofl.x = 0;
     zerofl.y = 0;
     zerofl.z = 0;
+    i.assign(numRays, zerofl);
+    io.assign(numRays, zerofl);
+    id.assign(numRays, zerofl);
+    ic.assign(numRays, zerofl);
+    ro.assign(numRays, zerofl);
+    rd.assign(numRays, zerofl);
+    normal.assign(numRays, zerofl);
+    indRatio.assign(numRays, 0);
+    ivalid.assign(numRays, 1);
+    rvalid.assign(numRays, 0);
+    isinside.assign(numRays, 0);
+    time = 0;
+    counts[0] = counts[1] = 0;
+    //Each valid incident ray yields two segments per iteration.
+    segs.resize(2 * numRays);
+}
+
+std::optional<std::pair<void*, size_t>> Traced_Shape::RayBatch::find(const std::string& name) {
+    auto array = [](auto& v) {
+        return std::optional<std::pair<void*, size_t>>(
+            {(void*)v.data(), sizeof(v[0]) * v.size()});
+    };
+    if (name == "i") return array(i);
+    if (name == "io") return array(io);
+    if (name == "id") return array(id);
+    if (name == "ic") return array(ic);
+    if (name == "ro") return array(ro);
+    if (name == "rd") return array(rd);
+    if (name == "normal") return array(normal);
+    if (name == "indRatio") return array(indRatio);
+    if (name == "ivalid") return array(ivalid);
+    if (name == "rvalid") return array(rvalid);
+    if (name == "isinside") return array(isinside);
+    if (name == "segs") return array(segs);
+    if (name == "time") return std::make_pair((void*)&time, sizeof(time));
+    if (name == "counts") return std::make_pair((void*)counts, sizeof(counts));
+    return std::nullopt;
+}
+
+void Traced_Shape::setInitBuffers(std::tuple<unsigned int, unsigned int, unsigned int> numRays) {
+    unsigned int totalRays = std::get<0>(numRays) * std::get<1>(numRays) * std::get<2>(numRays);
+    batch_.resize(totalRays);
 
-    argsData_["i"] = MemDataAttr(std::shared_ptr<cl_float3[]>(new cl_float3[totalRays]),
-                      "i", VarType::FLOAT3, sizeof(cl_float3) * totalRays);
-    argsData_["io"] = MemDataAttr(std::shared_ptr<cl_float3[]>(new cl_float3[totalRays]),
-                      "io", VarType::FLOAT3, sizeof(cl_float3) * totalRays);
-    argsData_["id"] = MemDataAttr(std::shared_ptr<cl_float3[]>(new cl_float3[totalRays]),
-                      "id", VarType::FLOAT3, sizeof(cl_float3) * totalRays);
-    argsData_["indRatio"] = MemDataAttr(std::shared_ptr<cl_float[]>(new cl_float[totalRays]),
-                      "indRatio", VarType::FLOAT, sizeof(cl_float) * totalRays);
-    argsData_["ro"] = MemDataAttr(std::shared_ptr<cl_float3[]>(new cl_float3[totalRays]{zerofl}),
-                      "ro", VarType::FLOAT3, sizeof(cl_float3) * totalRays);
-    argsData_["rd"] = MemDataAttr(std::shared_ptr<cl_float3[]>(new cl_float3[totalRays]{zerofl}),
-                      "rd", VarType::FLOAT3, sizeof(cl_float3) * totalRays);
-    argsData_["ivalid"] = MemDataAttr(std::shared_ptr<cl_int[]>(new cl_int[totalRays]{1}),
-                      "ivalid", VarType::INT, sizeof(cl_int) * totalRays);
-    argsData_["rvalid"] = MemDataAttr(std::shared_ptr<cl_int[]>(new cl_int[totalRays]{0}),
-                      "rvalid", VarType::INT, sizeof(cl_int) * totalRays);
-    argsData_["time"] = MemDataAttr(std::shared_ptr<cl_float[]>(new cl_float[1]{0}),
-                      "time", VarType::FLOAT, sizeof(cl_float) * 1);
-    argsData_["ic"] = MemDataAttr(std::shared_ptr<cl_float3[]>(new cl_float3[totalRays]),
-                      "ic", VarType::FLOAT3, sizeof(cl_float3) * totalRays);
-    argsData_["normal"] = MemDataAttr(std::shared_ptr<cl_float3[]>(new cl_float3[totalRays]{zerofl}),
-                      "normal", VarType::FLOAT3, sizeof(cl_float3) * totalRays);
-    argsData_["isinside"] = MemDataAttr(std::shared_ptr<cl_int[]>(new cl_int[totalRays]{0}),
-                      "isinside", VarType::INT, sizeof(cl_int) * totalRays);
     //Write initialRays.
+    cl_float3* in = batch_.i.data();
+    float da = fmax(1.0, (float)(std::get<0>(numRays) - 1));
+    float db = fmax(1.0, (float)(std::get<1>(numRays) - 1));
+    float dc = fmax(1.0, (float)(std::get<2>(numRays) - 1));
     unsigned int i = 0;
     for (unsigned int a=0; a< std::get<0>(numRays);a++) {
         for (unsigned int b=0; b< std::get<1>(numRays);b++) {
             for (unsigned int c=0; c< std::get<2>(numRays);c++) {
                 //Evenly spread i from 0.0 to 1.0.
-                std::reinterpret_pointer_cast<cl_float3[]>(argsData_["i"].data_).get()[i].x =
-                        (float)a/fmax(1.0, (float)(std::get<0>(numRays) - 1));
-                std::reinterpret_pointer_cast<cl_float3[]>(argsData_["i"].data_).get()[i].y =
-                        (float)b/fmax(1.0, (float)(std::get<1>(numRays) - 1));
-                std::reinterpret_pointer_cast<cl_float3[]>(argsData_["i"].data_).get()[i].z =
-                        (float)c/fmax(1.0, (float)(std::get<2>(numRays) - 1));
-                std::reinterpret_pointer_cast<cl_int[]>(argsData_["ivalid"].data_).get()[i] = 1;
-                std::reinterpret_pointer_cast<cl_int[]>(argsData_["rvalid"].data_).get()[i] = 0;
-                std::reinterpret_pointer_cast<cl_int[]>(argsData_["isinside"].data_).get()[i] = 0;
+                in[i].x = (float)a/da;
+                in[i].y = (float)b/db;
+                in[i].z = (float)c/dc;
                 i++;
             }
         }
@@ -625,26 +763,23 @@ void Traced_Shape::setInitialRays(const std::vector<Ray>& inputRays)
     unsigned int numRays = inputRays.size();
     setInitBuffers(std::tuple<unsigned int, unsigned int, unsigned int>(numRays, 1, 1));
     //Write initialRays.
+    cl_float3 c;
+    c.x = 1.0;
+    c.y = 1.0;
+    c.z = 1.0;
     for (unsigned int i=0; i<numRays;i++) {
-        cl_float3 o, d, c;
-        cl_float r;
+        cl_float3 o, d;
         o.x = inputRays[i].pos.x;
         o.y = inputRays[i].pos.y;
         o.z = inputRays[i].pos.z;
         d.x = inputRays[i].dir.x;
         d.y = inputRays[i].dir.y;
         d.z = inputRays[i].dir.z;
-        r = inputRays[i].refractIndRatio;
-        c.x = 1.0;
-        c.y = 1.0;
-        c.z = 1.0;
-
-        std::reinterpret_pointer_cast<cl_float3[]>(argsData_["io"].data_).get()[i] = o;
-        std::reinterpret_pointer_cast<cl_float3[]>(argsData_["id"].data_).get()[i] = d;
-        std::reinterpret_pointer_cast<cl_float3[]>(argsData_["ic"].data_).get()[i] = c;
-        std::reinterpret_pointer_cast<cl_float[]>(argsData_["indRatio"].data_).get()[i] = r;
-        //std::cout << "Init rays" << std::endl;
-        //std::cout << "ivalid is " << std::to_string(std::reinterpret_pointer_cast<cl_float[]>(argsData_["ivalid"].data_).get()[i]) << ", rvalid is " << std::to_string(std::reinterpret_pointer_cast<cl_float[]>(argsData_["rvalid"].data_).get()[i]) << std::endl;
+
+        batch_.io[i] = o;
+        batch_.id[i] = d;
+        batch_.ic[i] = c;
+        batch_.indRatio[i] = inputRays[i].refractIndRatio;
     }
 }
 
@@ -675,93 +810,15 @@ void Traced_Shape::setInitialRays() {
     finished_ = false;
 }
 
-bool Traced_Shape::propagate() {
-    bool ended = finished_ | (getNumRays() <= 0);
-    float far_away = 10000;
-    if (!ended) {
-#if 0
-        std::cout << "Propagate:" << std::endl;
-#endif
-        bool no_valid_rrays = true;
-        for (uint i=0; i < getNumRays(); i++) {
-            //Incident ray is valid?
-            bool is_i_valid = (std::reinterpret_pointer_cast<cl_int[]>(argsData_["ivalid"].data_).get()[i] == 1);
-            //Reflected ray is valid?
-            bool is_r_valid = (std::reinterpret_pointer_cast<cl_int[]>(argsData_["rvalid"].data_).get()[i] == 1);
-            no_valid_rrays &= !is_r_valid;
-            //Is the incident ray from inside the solid.
-            bool is_inside = (std::reinterpret_pointer_cast<cl_int[]>(argsData_["isinside"].data_).get()[i] == 1);
-
-            cl_float3 rd = std::reinterpret_pointer_cast<cl_float3[]>(argsData_["rd"].data_).get()[i];
-            cl_float3 ro = std::reinterpret_pointer_cast<cl_float3[]>(argsData_["ro"].data_).get()[i];
-            cl_float3 io = std::reinterpret_pointer_cast<cl_float3[]>(argsData_["io"].data_).get()[i];
-            cl_float3 norm = std::reinterpret_pointer_cast<cl_float3[]>(argsData_["normal"].data_).get()[i];
-#if 0
-            cl_float3 id = std::reinterpret_pointer_cast<cl_float3[]>(argsData_["id"].data_).get()[i];
-            std::cout << "i is " << std::to_string(i) << std::endl;
-            std::cout << "ivalid is " << std::to_string(is_i_valid) << ", rvalid is " << std::to_string(is_r_valid) << std::endl;
-            std::cout << "isinside is " << std::to_string(is_inside) << std::endl;
-            std::cout << "io is (" << std::to_string(io.x)
-                      << ", " << std::to_string(io.y)
-                      << ", " << std::to_string(io.z)
-                      << ")" << std::endl;
-            std::cout << "id is (" << std::to_string(id.x)
-                      << ", " << std::to_string(id.y)
-                      << ", " << std::to_string(id.z)
-                      << ")" << std::endl;
-            std::cout << "ro is (" << std::to_string(ro.x)
-                      << ", " << std::to_string(ro.y)
-                      << ", " << std::to_string(ro.z)
-                      << ")" << std::endl;
-            std::cout << "rd is (" << std::to_string(rd.x)
-                      << ", " << std::to_string(rd.y)
-                      << ", " << std::to_string(rd.z)
-                      << ")" << std::endl;
-            std::cout << "normal is (" << std::to_string(norm.x)
-                      << ", " << std::to_string(norm.y)
-                      << ", " << std::to_string(norm.z)
-                      << ")" << std::endl;
-            std::cout << "normal length is " << std::to_string(glm::length(glm::vec3(norm.x, norm.y, norm.z))) << std::endl;
-#endif
-            //Add valid reflected rays to result.
-            if (is_i_valid) {
-                glm::vec4 col;
-                if (is_inside) {
-                    col = glm::vec4(0.0,0.0,1.0,1.0);
-                } else {
-                    col = glm::vec4(0.0,1.0,1.0,1.0);
-                }
-                rays_.push_back(Ray{glm::vec3(io.x, io.y, io.z),
-                                    glm::vec3(ro.x - io.x, ro.y - io.y, ro.z - io.z),
-                                    col, 1});
-                if (!is_r_valid) {
-                    rays_.push_back(Ray{glm::vec3(ro.x, ro.y, ro.z),
-                                    glm::vec3(rd.x * far_away,
-                                              rd.y * far_away,
-                                              rd.z * far_away),
-                                    glm::vec4(1.0,0.0,0.0,1.0), 1});
-                } else {
-                    rays_.push_back(Ray{glm::vec3(ro.x, ro.y, ro.z),
-                                    glm::vec3(norm.x * 0.1, norm.y * 0.1, norm.z * 0.1),
-                                    glm::vec4(0.0,1.0,0.0,1), 1});
-                }
-            }
-        }
-        //check if propagation is finished, update finished_ if neccessary.
-        if (no_valid_rrays) {
-            finished_ = true;
-            ended = true;
-        } else {
-            //Exchange incident ray buffers with those of reflected ray.
-            argsData_["rd"].data_.swap(argsData_["id"].data_);
-            argsData_["ro"].data_.swap(argsData_["io"].data_);
-            argsData_["ivalid"].data_.swap(argsData_["rvalid"].data_);
-        }
-#if 0
-        std::cout << "finished is " << std::to_string(finished_) << "ended is " << std::to_string(ended) << std::endl;
-#endif
+void Traced_Shape::addSegments(const Segment* segs, size_t count) {
+    rays_.reserve(rays_.size() + count);
+    for (size_t i = 0; i < count; i++) {
+        const Segment& s = segs[i];
+        rays_.push_back(Ray{glm::vec3(s.pos.s[0], s.pos.s[1], s.pos.s[2]),
+                            glm::vec3(s.dir.s[0], s.dir.s[1], s.dir.s[2]),
+                            glm::vec4(s.colour.s[0], s.colour.s[1],
+                                      s.colour.s[2], s.colour.s[3]), 1});
     }
-    return ended;
 }
 
 std::vector<Traced_Shape::KernelParam> Traced_Shape::getKernelArgParams() {
@@ -788,21 +845,16 @@ std::vector<Traced_Shape::KernelParam> Traced_Shape::getArgParams(ParamSet set)
     }
 
     for (auto e: paramSet) {
-        if (auto data = getData(std::get<0>(e))) {
+        if (auto data = batch_.find(std::get<0>(e))) {
             result.push_back(Traced_Shape::KernelParam(std::get<0>(e),
                     getVarIndex(paramSet, std::get<0>(e), std::get<1>(e), std::get<2>(e)),
-                    std::get<1>(e), std::get<2>(e), data->size_,
-                    data->data_.get(), std::get<3>(e)));
+                    std::get<1>(e), std::get<2>(e), data->second,
+                    data->first, std::get<3>(e)));
         }
     }
     return result;
 }
 
-std::optional<Traced_Shape::MemDataAttr> Traced_Shape::getData(const std::string& param) {
-    return argsData_.find(param) != argsData_.end() ?
-            std::optional<MemDataAttr>(argsData_[param]) : std::nullopt;
-}
-
 std::string Traced_Shape::getRayCalcKernelName() {
     return DEFAULT_RAY_CALC_KERNEL_NAME;
 }
@@ -811,4 +863,16 @@ std::string Traced_Shape::getInitRayKernelName() {
     return DEFAULT_INIT_RAY__KERNEL_NAME;
 }
 
+std::string Traced_Shape::getScanGroupsKernelName() {
+    return DEFAULT_SCAN_GROUPS_KERNEL_NAME;
+}
+
+std::string Traced_Shape::getScanSumsKernelName() {
+    return DEFAULT_SCAN_SUMS_KERNEL_NAME;
+}
+
+std::string Traced_Shape::getCompactKernelName() {
+    return DEFAULT_COMPACT_KERNEL_NAME;
+}
+
 } //namespace
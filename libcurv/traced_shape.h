@@ -12,6 +12,8 @@
 #include <CL/cl.h>
 #include <optional>
 #include <tuple>
+#include <utility>
+#include <vector>
 #include <libcurv/rays.h>
 
 
@@ -34,18 +36,6 @@ struct Traced_Shape : Viewed_Shape
 
     enum ParamSet {RAY_INIT, KERNEL};
 
-    struct MemDataAttr {
-        std::shared_ptr<void> data_ = nullptr;
-        std::string name_;
-        VarType dataType_;
-        size_t size_ = 0;
-        MemDataAttr(const std::shared_ptr<void> data, const std::string& name, VarType dataType, size_t size)
-            : data_(data), name_(name), dataType_(dataType), size_(size) {}
-        MemDataAttr(const MemDataAttr& attr)
-            : data_(attr.data_), name_(attr.name_), dataType_(attr.dataType_), size_(attr.size_) {}
-        MemDataAttr() : data_(nullptr), name_(""), dataType_(VarType::UNKNOWN), size_(0) {}
-    };
-
     struct KernelParam {
         std::string name_;
         int index_;
@@ -57,6 +47,28 @@ struct Traced_Shape : Viewed_Shape
         KernelParam(const std::string& name, int index, VarType varType, bool isArray, size_t bufferSize, void* bufferPtr, cl_mem_flags bufferFlags) : name_(name), index_(index), varType_(varType), isArray_(isArray), bufferSize_(bufferSize), bufferPtr_(bufferPtr), bufferFlags_(bufferFlags) {}
     };
 
+    //A segment of a ray path, as written by the ray calculation kernel.
+    struct Segment {
+        cl_float4 pos;
+        cl_float4 dir;
+        cl_float4 colour;
+    };
+
+    //Host ray state as a structure of arrays, one typed array per kernel
+    //parameter, so that loops over the rays index the arrays directly.
+    struct RayBatch {
+        std::vector<cl_float3> i, io, id, ic, ro, rd, normal;
+        std::vector<cl_float> indRatio;
+        std::vector<cl_int> ivalid, rvalid, isinside;
+        std::vector<Segment> segs;
+        cl_float time = 0;
+        cl_int counts[2] = {0, 0};
+
+        //Allocate and reset the arrays for numRays rays.
+        void resize(unsigned int numRays);
+        //The host memory and size in bytes of a kernel parameter.
+        std::optional<std::pair<void*, size_t>> find(const std::string& name);
+    };
 
     std::string clprog_, clinitprog_;
 
@@ -87,8 +99,8 @@ struct Traced_Shape : Viewed_Shape
     unsigned int getNumRays() { return std::get<0>(numRays_) * std::get<1>(numRays_) * std::get<2>(numRays_); }
     //Get result rays.
     const std::vector<Ray> getResultRays() { return rays_; };
-    //Propagate ray calculation, returns true if calculation is finished.
-    bool propagate();
+    //Append ray segments read back from the ray calculation kernel to the result.
+    void addSegments(const Segment* segs, size_t count);
     //Get kernel args parameters.
     // Returns a tuple of parameter name, index, data type, is array, data array size, pointer to param array, openCl buffer flags.
     //std::vector<std::tuple<std::string, int, Traced_Shape::VarType, bool, size_t, void*, cl_mem_flags>>
@@ -98,16 +110,20 @@ struct Traced_Shape : Viewed_Shape
     //General method to get all parameters.
     std::vector<KernelParam> getArgParams(ParamSet set);
 
-    //Data storage.
-    std::map<std::string, MemDataAttr> argsData_;
-
-    //Getters and setters.
-    std::optional<MemDataAttr> getData(const std::string& param);
+    //Host copy of the kernel parameters, uploaded when a calculation starts.
+    RayBatch batch_;
 
     std::string getRayCalcKernelName();
 
     std::string getInitRayKernelName();
 
+    //Stream compaction kernels, in the ray calculation program. They are run
+    //with this local size, or a smaller power of 2 if the kernel limit is lower.
+    static constexpr unsigned COMPACT_GROUP_SIZE = 128;
+    std::string getScanGroupsKernelName();
+    std::string getScanSumsKernelName();
+    std::string getCompactKernelName();
+
 };
 
 } //namespace
@@ -52,6 +52,7 @@ struct Ref_Value : public Shared_Base
             sty_dir_record,
         ty_function,
         ty_lambda,
+        ty_thunk,
         ty_reactive,
             sty_uniform_variable,
             sty_reactive_expression,
@@ -0,0 +1 @@
+#define CURV_VERSION "3aa3158-dirty"
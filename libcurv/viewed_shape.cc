@@ -125,6 +125,33 @@ Viewed_Shape::Viewed_Shape(const Shape_Program& shape, const Render_Opts& opts)
     }
 }
 
+// Parameters are compared using their JSON serializations, since
+// Picker::Config and Picker::State have no equality operators.
+static std::string
+param_signature(const Viewed_Shape::Parameter& p)
+{
+    std::stringstream out;
+    out << p.identifier_ << ":";
+    p.pconfig_.write_json(out);
+    out << "=";
+    p.default_state_.write_json(out, p.pconfig_.type_);
+    return out.str();
+}
+
+bool
+Viewed_Shape::same_program(const Viewed_Shape& s) const
+{
+    if (frag_ != s.frag_ || param_.size() != s.param_.size())
+        return false;
+    for (auto& p : param_) {
+        auto q = s.param_.find(p.first);
+        if (q == s.param_.end()
+            || param_signature(p.second) != param_signature(q->second))
+            return false;
+    }
+    return true;
+}
+
 void
 Viewed_Shape::write_json(std::ostream& out) const
 {
@@ -71,6 +71,12 @@ struct Viewed_Shape
 
     bool empty() const { return frag_.empty(); }
 
+    // True if both shapes have the same frag program and the same
+    // parameters (names, uniforms, picker configs and default values).
+    // Picker state is ignored. Used to avoid reloading the shader when a
+    // program is re-evaluated with an identical result.
+    bool same_program(const Viewed_Shape&) const;
+
     // Serialize as a sequence of JSON object fields,
     // without an enclosing '{...}'.
     void write_json(std::ostream&) const;
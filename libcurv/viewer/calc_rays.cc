@@ -4,8 +4,13 @@
 
 #include "libcurv/traced_shape.h"
 #include <libcurv/viewer/calc_rays.h>
+#include <libcurv/viewer/disk_cache.h>
 #include <libcurv/die.h>
 #include <CL/cl.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <limits>
 #include <memory>
 #include <iostream>
 #include <optional>
@@ -73,7 +78,75 @@ void RayCalc::close() {
     }
 }
 
+//Built programs are cached in memory for the life of the OpenCL context,
+//and their device binaries are cached on disk in the "opencl" cache (see
+//disk_cache.h), keyed by the source and the device, driver and OpenCL
+//versions. A binary still has to be built, but that skips compilation.
+std::string RayCalc::deviceInfo(cl_device_info param) {
+    size_t size = 0;
+    if (clGetDeviceInfo(device_id_, param, 0, NULL, &size) != CL_SUCCESS)
+        return "";
+    std::string info(size, '\0');
+    clGetDeviceInfo(device_id_, param, size, &info[0], NULL);
+    return info;
+}
+
+std::optional<cl_program> RayCalc::loadCachedProgram(const std::string& path) {
+    std::vector<char> data;
+    if (path.empty() || !read_cache_file(path, data))
+        return std::nullopt;
+    size_t length = data.size();
+    const unsigned char* binary = (const unsigned char*) data.data();
+    cl_int status, err;
+    cl_program prog = clCreateProgramWithBinary(clContext_, 1, &device_id_,
+                                                &length, &binary, &status, &err);
+    if (err == CL_SUCCESS && status == CL_SUCCESS) {
+        err = clBuildProgram(prog, 0, NULL, NULL, NULL, NULL);
+        if (err == CL_SUCCESS)
+            return prog;
+    }
+    //The driver rejected the binary.
+    if (prog != nullptr)
+        clReleaseProgram(prog);
+    remove_cache_file(path);
+    return std::nullopt;
+}
+
+void RayCalc::saveCachedProgram(cl_program prog, const std::string& path) {
+    if (path.empty())
+        return;
+    size_t length = 0;
+    if (clGetProgramInfo(prog, CL_PROGRAM_BINARY_SIZES, sizeof(length),
+                         &length, NULL) != CL_SUCCESS || length == 0)
+        return;
+    std::vector<char> data(length);
+    unsigned char* binary = (unsigned char*) data.data();
+    if (clGetProgramInfo(prog, CL_PROGRAM_BINARIES, sizeof(binary),
+                         &binary, NULL) != CL_SUCCESS)
+        return;
+    write_cache_file(path, data);
+}
+
 std::optional<cl_program>  RayCalc::compileProgram(const std::string& source, RayCalcRetCode& code) {
+    auto found = programs_.find(source);
+    if (found != programs_.end()) {
+        code = RayCalcRetCode::OK;
+        return found->second;
+    }
+    Fnv1a key;
+    key.add(deviceInfo(CL_DEVICE_VENDOR));
+    key.add(deviceInfo(CL_DEVICE_NAME));
+    key.add(deviceInfo(CL_DEVICE_VERSION));
+    key.add(deviceInfo(CL_DRIVER_VERSION));
+    key.add(source);
+    std::string path = cache_path("opencl", key).string();
+    if (auto cached = loadCachedProgram(path)) {
+        std::cout << "Program loaded from cache." << std::endl;
+        programs_[source] = cached.value();
+        code = RayCalcRetCode::OK;
+        return cached;
+    }
+
     cl_program prog = nullptr;
     //Compile program.
     cl_int err;
@@ -107,6 +180,8 @@ std::optional<cl_program>  RayCalc::compileProgram(const std::string& source, Ra
         } else {
             std::cout << "Program built successfully." << std::endl;
             code = RayCalcRetCode::OK;
+            saveCachedProgram(prog, path);
+            programs_[source] = prog;
         }
     }
     return code == RayCalcRetCode::OK && prog != nullptr ?
@@ -119,6 +194,10 @@ std::optional<cl_kernel> RayCalc::genKernel(cl_program prog, const std::string&
     if (prog == nullptr || kernelName.empty()) {
         std::cout << "Program or kernel name is null" << std::endl;
         code = RayCalcRetCode::INPUT_ERROR;
+    } else if (auto found = kernels_.find({prog, kernelName});
+               found != kernels_.end()) {
+        kernel = found->second;
+        code = RayCalcRetCode::OK;
     } else {
         kernel = clCreateKernel(prog, kernelName.c_str(), &err);
         if (!kernel || err != CL_SUCCESS) {
@@ -128,6 +207,7 @@ std::optional<cl_kernel> RayCalc::genKernel(cl_program prog, const std::string&
         } else {
             std::cout << "Kernel create successfully." << std::endl;
             code = RayCalcRetCode::OK;
+            kernels_[{prog, kernelName}] = kernel;
         }
     }
     return code == RayCalcRetCode::OK && kernel != nullptr ?
@@ -162,18 +242,18 @@ RayCalcRetCode RayCalc::setParameters(Traced_Shape& shape) {
     //Refraction index ratio(float).
     return result;
 }
-std::optional<cl_mem> RayCalc::createAndLoadBuffer(cl_kernel kernel, const Traced_Shape::KernelParam& param) {
+std::optional<cl_mem> RayCalc::createBuffer(const Traced_Shape::KernelParam& param) {
     cl_int err;
     cl_mem memObj = NULL;
+    //Output-only buffers have nothing to upload.
+    cl_mem_flags flags = param.bufferFlags_;
+    if (!(flags & CL_MEM_WRITE_ONLY))
+        flags |= CL_MEM_COPY_HOST_PTR;
     //Create memory object.
-    memObj = clCreateBuffer(clContext_, param.bufferFlags_ |
-                            CL_MEM_ALLOC_HOST_PTR | CL_MEM_COPY_HOST_PTR,
-                            param.bufferSize_, param.bufferPtr_, &err);
-    if (memObj != NULL && err == CL_SUCCESS) {
-        //Load kernel parameters.
-        setKernelArgs(kernel, param.index_, param.varType_,
-                      param.isArray_, sizeof(cl_mem), (void*)&memObj);
-    } else {
+    memObj = clCreateBuffer(clContext_, flags, param.bufferSize_,
+                            (flags & CL_MEM_COPY_HOST_PTR) ? param.bufferPtr_ : NULL,
+                            &err);
+    if (memObj == NULL || err != CL_SUCCESS) {
         std::cout << "Error creating memory object for parameter " <<
                 param.name_ << ", index " <<
                 std::to_string(param.index_) << ", data type " <<
@@ -186,69 +266,242 @@ std::optional<cl_mem> RayCalc::createAndLoadBuffer(cl_kernel kernel, const Trace
 
 }
 
+bool RayCalc::bindBuffers(cl_kernel kernel,
+                          const std::vector<Traced_Shape::KernelParam>& params,
+                          Buffers& buffers) {
+    for (auto& param : params) {
+        auto b = buffers.find(param.name_);
+        if (b == buffers.end()) {
+            if (auto memObj = createBuffer(param)) {
+                b = buffers.emplace(param.name_, memObj.value()).first;
+            } else {
+                return false;
+            }
+        }
+        setKernelArgs(kernel, param.index_, param.varType_,
+                      param.isArray_, sizeof(cl_mem), (void*)&b->second);
+    }
+    return true;
+}
+
+void RayCalc::releaseBuffers(Buffers& buffers) {
+    for (auto& b : buffers)
+        clReleaseMemObject(b.second);
+    buffers.clear();
+}
+
 cl_int RayCalc::runKernel(cl_kernel kernel, size_t* global_size, size_t* local_size) {
     return clEnqueueNDRangeKernel(command_queue_, kernel, 1, NULL,
                 global_size, local_size, 0, NULL, NULL);
 }
 
-cl_int RayCalc::readBack(cl_mem memObj, const Traced_Shape::KernelParam& param) {
-    //if (param.bufferFlags_ == CL_MEM_WRITE_ONLY ||
-    //        param.bufferFlags_ == CL_MEM_READ_WRITE) {
-        cl_int err = clEnqueueReadBuffer(command_queue_, memObj, CL_TRUE, 0,
-                param.bufferSize_, param.bufferPtr_ , 0, NULL, NULL);
-        if (err != CL_SUCCESS) {
-            std::cout << "Error writing from buffer pameter " <<
-                param.name_ << ", index " <<
-                std::to_string(param.index_) << ", data type " <<
-                std::to_string(param.varType_) << ", is array " <<
-                std::to_string(param.isArray_) << ", buffer size" <<
-                std::to_string(param.bufferSize_) << std::endl;
+//The local size of the ray kernels is tuned for each device and kernel,
+//by timing the first launch with each candidate size. The result is cached
+//in memory, and on disk in the "opencl-tune" cache, keyed like the
+//"opencl" program cache plus the kernel name.
+size_t RayCalc::localSize(cl_kernel kernel, const std::string& source,
+                          const std::string& kernelName, size_t n,
+                          const std::function<void()>& reset) {
+    auto found = localSizes_.find(kernel);
+    if (found != localSizes_.end())
+        return found->second;
+
+    Fnv1a key;
+    key.add(deviceInfo(CL_DEVICE_VENDOR));
+    key.add(deviceInfo(CL_DEVICE_NAME));
+    key.add(deviceInfo(CL_DEVICE_VERSION));
+    key.add(deviceInfo(CL_DRIVER_VERSION));
+    key.add(source);
+    key.add(kernelName);
+    auto path = cache_path("opencl-tune", key);
+    std::vector<char> data;
+    if (!path.empty() && read_cache_file(path, data)) {
+        size_t local = std::strtoul(std::string(data.begin(), data.end()).c_str(),
+                                    nullptr, 10);
+        if (local > 0) {
+            localSizes_[kernel] = local;
+            return local;
+        }
+        remove_cache_file(path);
+    }
+
+    //Candidates are the multiples of the preferred size, by powers of 2,
+    //up to the largest size the kernel can be launched with.
+    size_t maxSize = 1, multiple = 1;
+    clGetKernelWorkGroupInfo(kernel, device_id_, CL_KERNEL_WORK_GROUP_SIZE,
+                             sizeof(maxSize), &maxSize, NULL);
+    clGetKernelWorkGroupInfo(kernel, device_id_,
+                             CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+                             sizeof(multiple), &multiple, NULL);
+    multiple = std::max<size_t>(1, std::min(multiple, maxSize));
+    size_t best = multiple;
+    double bestTime = std::numeric_limits<double>::infinity();
+    for (size_t local = multiple; local <= maxSize && local <= 1024; local *= 2) {
+        size_t global = (n + local - 1) / local * local;
+        double time = std::numeric_limits<double>::infinity();
+        //The first run of each size is a warm-up.
+        for (int run = 0; run < 3; ++run) {
+            reset();
+            clFinish(command_queue_);
+            auto start = std::chrono::steady_clock::now();
+            cl_int err = runKernel(kernel, &global, &local);
+            clFinish(command_queue_);
+            auto end = std::chrono::steady_clock::now();
+            if (err != CL_SUCCESS) {
+                time = std::numeric_limits<double>::infinity();
+                break;
+            }
+            if (run > 0)
+                time = std::min(time,
+                    std::chrono::duration<double>(end - start).count());
         }
-    //}
+        if (time < bestTime) {
+            bestTime = time;
+            best = local;
+        }
+        if (local >= n)
+            break;
+    }
+    std::cout << "Kernel " << kernelName << ": local size " << best << std::endl;
+    localSizes_[kernel] = best;
+    std::string text = std::to_string(best);
+    if (!path.empty())
+        write_cache_file(path, std::vector<char>(text.begin(), text.end()));
+    return best;
+}
+
+cl_int RayCalc::runRays(cl_kernel kernel, const std::string& source,
+                        const std::string& kernelName, cl_uint nIndex, cl_uint n,
+                        const std::function<void()>& reset) {
+    cl_int err = clSetKernelArg(kernel, nIndex, sizeof(cl_uint), &n);
+    if (err != CL_SUCCESS)
+        return err;
+    size_t local = localSize(kernel, source, kernelName, n, reset);
+    //The kernels ignore the work items past n.
+    size_t global = (n + local - 1) / local * local;
+    reset();
+    return runKernel(kernel, &global, &local);
+}
+
+cl_int RayCalc::readSegments(Traced_Shape& shape, Buffers& buffers, cl_int& numReflected) {
+    cl_int counts[2] = {0, 0};
+    cl_int err = clEnqueueReadBuffer(command_queue_, buffers["counts"], CL_TRUE, 0,
+            sizeof(counts), counts, 0, NULL, NULL);
+    numReflected = counts[1];
+    if (err == CL_SUCCESS && counts[0] > 0) {
+        //Only the segments written by this iteration are transferred.
+        auto& segs = shape.batch_.segs;
+        err = clEnqueueReadBuffer(command_queue_, buffers["segs"], CL_TRUE, 0,
+                sizeof(Traced_Shape::Segment) * counts[0], segs.data(), 0, NULL, NULL);
+        if (err == CL_SUCCESS)
+            shape.addSegments(segs.data(), counts[0]);
+    }
+    if (err != CL_SUCCESS) {
+        std::cout << "Error reading back ray segments." << std::endl;
+        print_opencl_results(err);
+    }
+    return err;
+}
+
+cl_mem RayCalc::deviceBuffer(Buffers& buffers, const std::string& name, size_t size) {
+    auto b = buffers.find(name);
+    if (b == buffers.end()) {
+        cl_int err;
+        cl_mem memObj = clCreateBuffer(clContext_, CL_MEM_READ_WRITE, size, NULL, &err);
+        if (memObj == NULL || err != CL_SUCCESS) {
+            print_opencl_results(err);
+            die(("Error creating device buffer " + name + ".").c_str());
+        }
+        b = buffers.emplace(name, memObj).first;
+    }
+    return b->second;
+}
+
+cl_int RayCalc::compactRays(Traced_Shape& shape, cl_program prog, Buffers& buffers, cl_uint n) {
+    RayCalcRetCode code;
+    auto scanGroups = genKernel(prog, shape.getScanGroupsKernelName(), code);
+    auto scanSums = genKernel(prog, shape.getScanSumsKernelName(), code);
+    auto compact = genKernel(prog, shape.getCompactKernelName(), code);
+    if (!scanGroups || !scanSums || !compact)
+        return CL_INVALID_KERNEL;
+
+    //scan_groups and compact share the local size, which must fit both.
+    size_t group = Traced_Shape::COMPACT_GROUP_SIZE;
+    for (cl_kernel k : {scanGroups.value(), compact.value()}) {
+        size_t maxSize = 0;
+        if (clGetKernelWorkGroupInfo(k, device_id_, CL_KERNEL_WORK_GROUP_SIZE,
+                                     sizeof(maxSize), &maxSize, NULL) != CL_SUCCESS)
+            maxSize = 1;
+        while (group > maxSize && group > 1)
+            group /= 2;
+    }
+    size_t global = (n + group - 1) / group * group;
+    cl_uint ngroups = global / group;
+    unsigned numRays = shape.getNumRays();
+    cl_mem offsets = deviceBuffer(buffers, "offsets", sizeof(cl_int) * numRays);
+    cl_mem groupSums = deviceBuffer(buffers, "groupSums",
+            sizeof(cl_int) * ((numRays + group - 1) / group));
+    cl_mem nextIndRatio = deviceBuffer(buffers, "nextIndRatio", sizeof(cl_float) * numRays);
+
+    cl_int err = CL_SUCCESS;
+    cl_kernel k = scanGroups.value();
+    err |= clSetKernelArg(k, 0, sizeof(cl_mem), &buffers["rvalid"]);
+    err |= clSetKernelArg(k, 1, sizeof(cl_mem), &offsets);
+    err |= clSetKernelArg(k, 2, sizeof(cl_mem), &groupSums);
+    err |= clSetKernelArg(k, 3, sizeof(cl_int) * group, NULL);
+    err |= clSetKernelArg(k, 4, sizeof(cl_uint), &n);
+    err |= runKernel(k, &global, &group);
+
+    size_t one = 1;
+    k = scanSums.value();
+    err |= clSetKernelArg(k, 0, sizeof(cl_mem), &groupSums);
+    err |= clSetKernelArg(k, 1, sizeof(cl_uint), &ngroups);
+    err |= runKernel(k, &one, &one);
+
+    k = compact.value();
+    err |= clSetKernelArg(k, 0, sizeof(cl_mem), &buffers["rvalid"]);
+    err |= clSetKernelArg(k, 1, sizeof(cl_mem), &offsets);
+    err |= clSetKernelArg(k, 2, sizeof(cl_mem), &groupSums);
+    err |= clSetKernelArg(k, 3, sizeof(cl_mem), &buffers["ro"]);
+    err |= clSetKernelArg(k, 4, sizeof(cl_mem), &buffers["rd"]);
+    err |= clSetKernelArg(k, 5, sizeof(cl_mem), &buffers["indRatio"]);
+    err |= clSetKernelArg(k, 6, sizeof(cl_mem), &buffers["io"]);
+    err |= clSetKernelArg(k, 7, sizeof(cl_mem), &buffers["id"]);
+    err |= clSetKernelArg(k, 8, sizeof(cl_mem), &buffers["ivalid"]);
+    err |= clSetKernelArg(k, 9, sizeof(cl_mem), &nextIndRatio);
+    err |= clSetKernelArg(k, 10, sizeof(cl_uint), &n);
+    err |= runKernel(k, &global, &group);
+
+    //The refraction index ratios were packed into a second buffer, since
+    //compact can't permute them in place.
+    std::swap(buffers["indRatio"], buffers["nextIndRatio"]);
+    if (err != CL_SUCCESS) {
+        std::cout << "Error compacting rays." << std::endl;
+        print_opencl_results(err);
+    }
     return err;
 }
 
 RayCalcResult RayCalc::calculate(Traced_Shape& shape) {
     RayCalcResult result;
-    bool finished = false;
     uint iterations = 1;
-    cl_int err = 0;
+    cl_int err = CL_SUCCESS;
     RayCalcRetCode code;
+    Buffers buffers;
     shape.setInitialRays();
     if (shape.getNumRays() > 0) {
-        //Ray initialization (if exists)
+        //Ray initialization (if exists). Its results are left on the device
+        //for the ray calculation kernel.
         if (shape.calc_init_rays_) {
             if (auto initprog = compileProgram(shape.clinitprog_, code)) {
                 if(auto kernel = genKernel(initprog.value(), shape.getInitRayKernelName(), code)) {
-                    //Tuple of parameters, with host memery obj.
-                    std::vector<std::tuple<
-                    Traced_Shape::KernelParam,
-                    cl_mem>> buffers;
-                    for (auto param : shape.getRayInitArgParams()) {
-                         if (auto memObj = createAndLoadBuffer(kernel.value(), param)) {
-                            buffers.push_back(std::make_tuple(param, memObj.value()));
-                         } else {
-                             die("Error creating and loading buffer.");
-                         }
-                    }
+                    auto params = shape.getRayInitArgParams();
+                    if (!bindBuffers(kernel.value(), params, buffers))
+                        die("Error creating and loading buffer.");
                     // Queue OpenCL kernel on the list
-                    size_t global_item_size = shape.getNumRays(); // Process the entire lists
-                    size_t local_item_size = shape.getNumRays();
-                    err &= runKernel(kernel.value(), &global_item_size, &local_item_size);
-                    //Queue transfer from device to host.
-                    for (auto e : buffers) {
-                        auto param = std::get<0>(e);
-                        auto memObj = std::get<1>(e);
-                        err &= readBack(memObj, param);
-                    }
-                    //Let the calculation finish.
-                    //clFlush(command_queue_);
-                    clFinish(command_queue_);
-                    //Release buffers.
-                    for (auto b : buffers)
-                        if (std::get<1>(b) != nullptr) {
-                            clReleaseMemObject(std::get<1>(b));
-                        }
+                    err |= runRays(kernel.value(), shape.clinitprog_,
+                                   shape.getInitRayKernelName(), params.size(),
+                                   shape.getNumRays(), []{});
                 } else {
                     std::cout << "Ray initialization kernel failed to build." << std::endl;
                 }
@@ -259,40 +512,40 @@ RayCalcResult RayCalc::calculate(Traced_Shape& shape) {
         //Ray propagation.
         if (auto prog = compileProgram(shape.clprog_, code)) {
             if (auto kernel = genKernel(prog.value(), shape.getRayCalcKernelName(), code)) {
+                auto params = shape.getKernelArgParams();
+                if (!bindBuffers(kernel.value(), params, buffers))
+                    die("Error creating and loading buffer.");
+                const cl_int zero[2] = {0, 0};
+                cl_int numReflected = 0;
+                //The live rays are packed at the start of the incident ray
+                //buffers, and each launch only covers them.
+                cl_uint numLive = shape.getNumRays();
+                auto resetCounts = [&]{
+                    err |= clEnqueueWriteBuffer(command_queue_, buffers["counts"], CL_FALSE,
+                            0, sizeof(zero), zero, 0, NULL, NULL);
+                };
                 do {
-                    //Tuple of parameters, with host memery obj.
-                    std::vector<std::tuple<
-                    Traced_Shape::KernelParam,
-                    cl_mem>> buffers;
-                    for (auto param : shape.getKernelArgParams()) {
-                         if (auto memObj = createAndLoadBuffer(kernel.value(), param)) {
-                            buffers.push_back(std::make_tuple(param, memObj.value()));
-                         } else {
-                             die("Error creating and loading buffer.");
-                         }
-                    }
                     // Queue OpenCL kernel on the list
-                    size_t global_item_size = shape.getNumRays(); // Process the entire lists
-                    size_t local_item_size = shape.getNumRays();
-                    err &= runKernel(kernel.value(), &global_item_size, &local_item_size);
-                    //Queue transfer from device to host.
-                    for (auto e : buffers) {
-                        auto param = std::get<0>(e);
-                        auto memObj = std::get<1>(e);
-                        err &= readBack(memObj, param);
-                    }
-                    //Let the calculation finish.
-                    //clFlush(command_queue_);
-                    clFinish(command_queue_);
-                    //Release buffers.
-                    for (auto b : buffers)
-                        if (std::get<1>(b) != nullptr) {
-                            clReleaseMemObject(std::get<1>(b));
+                    err |= runRays(kernel.value(), shape.clprog_,
+                                   shape.getRayCalcKernelName(), params.size(),
+                                   numLive, resetCounts);
+                    //Waits for the kernel, and transfers only its output segments.
+                    err |= readSegments(shape, buffers, numReflected);
+                    if (err != CL_SUCCESS || numReflected == 0)
+                        break;
+                    //The reflected rays are the next incident rays.
+                    err |= compactRays(shape, prog.value(), buffers, numLive);
+                    numLive = numReflected;
+                    for (auto& param : params) {
+                        if (param.name_ == "indRatio") {
+                            setKernelArgs(kernel.value(), param.index_,
+                                param.varType_, param.isArray_, sizeof(cl_mem),
+                                (void*)&buffers[param.name_]);
                         }
-                    //Get result.
-                    finished = shape.propagate();
+                    }
                     iterations++;
-                } while (!finished && iterations < param_.maxIter);
+                } while (err == CL_SUCCESS && iterations < param_.maxIter);
+                shape.finished_ = true;
             } else {
                 //die ("Error creating kernel");
                 std::cout << "Error creating kernel" << std::endl;
@@ -301,6 +554,8 @@ RayCalcResult RayCalc::calculate(Traced_Shape& shape) {
             //die ("Error creating program");
             std::cout << "Error creating program" << std::endl;
         }
+        clFinish(command_queue_);
+        releaseBuffers(buffers);
         result.rays = shape.getResultRays();
         result.numInitialRays = shape.getNumRays();
         result.numHits = 0;
@@ -339,6 +594,13 @@ void RayCalc::setup() {
 }
 
 void RayCalc::closeCL() {
+    for (auto& k : kernels_)
+        clReleaseKernel(k.second);
+    kernels_.clear();
+    localSizes_.clear();
+    for (auto& p : programs_)
+        clReleaseProgram(p.second);
+    programs_.clear();
     if (command_queue_ != NULL) {
         clFlush(command_queue_);
         clFinish(command_queue_);
@@ -7,9 +7,13 @@
 #include <libcurv/traced_shape.h>
 #include <CL/cl.h>
 #include <vector>
+#include <functional>
 #include <tuple>
 #include <map>
 #include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
 
 namespace curv {
 namespace viewer {
@@ -47,19 +51,50 @@ struct RayCalc
     cl_device_id device_id_ = NULL;
 //OpenCL programs.
     Parameters param_;
+    //Built programs, keyed by source, and their kernels, keyed by
+    //program and kernel name. Owned by the cache; released by closeCL().
+    std::unordered_map<std::string, cl_program> programs_;
+    std::map<std::pair<cl_program, std::string>, cl_kernel> kernels_;
+    std::map<cl_kernel, size_t> localSizes_;
 /*--- INTERNAL STATE ---*/
     bool error_=false;
     bool initialized_=false;
 // INTERNAL FUNCTIONS
     bool initCL();
+    std::string deviceInfo(cl_device_info param);
+    std::optional<cl_program> loadCachedProgram(const std::string& path);
+    void saveCachedProgram(cl_program prog, const std::string& path);
     void setup();
     void closeCL();
     void setKernelArgs(cl_kernel& kernel, int index,
             const Traced_Shape::VarType& paramType, const bool isArray,
             const size_t size, void* memObj);
-    std::optional<cl_mem> createAndLoadBuffer(cl_kernel kernel, const Traced_Shape::KernelParam& param);
+    //Ray state stays on the device for a whole calculation: one buffer per
+    //kernel parameter name, shared by the init and ray calculation kernels.
+    using Buffers = std::map<std::string, cl_mem>;
+    std::optional<cl_mem> createBuffer(const Traced_Shape::KernelParam& param);
+    //Set the kernel arguments, creating the buffers that are not yet on the device.
+    bool bindBuffers(cl_kernel kernel, const std::vector<Traced_Shape::KernelParam>& params, Buffers& buffers);
+    void releaseBuffers(Buffers& buffers);
     cl_int runKernel(cl_kernel kernel, size_t* global_size, size_t* local_size);
-    cl_int readBack(cl_mem memObj, const Traced_Shape::KernelParam& param);
+    //Tuned local size of a ray kernel, benchmarked on first use with n rays.
+    //reset() restores the kernel's side effects before each timed run.
+    size_t localSize(cl_kernel kernel, const std::string& source,
+            const std::string& kernelName, size_t n,
+            const std::function<void()>& reset);
+    //Run a ray kernel over n rays, padding the global size to a multiple of
+    //the local size. The ray count is the kernel argument at nIndex.
+    cl_int runRays(cl_kernel kernel, const std::string& source,
+            const std::string& kernelName, cl_uint nIndex, cl_uint n,
+            const std::function<void()>& reset);
+    //Get a device-only buffer, creating it on first use.
+    cl_mem deviceBuffer(Buffers& buffers, const std::string& name, size_t size);
+    //Pack the n rays of the last iteration that have a valid reflected ray
+    //into the incident ray buffers.
+    cl_int compactRays(Traced_Shape& shape, cl_program prog, Buffers& buffers, cl_uint n);
+    //Read back the segments written by one iteration, and the number of
+    //valid reflected rays.
+    cl_int readSegments(Traced_Shape& shape, Buffers& buffers, cl_int& numReflected);
 
 
 };
@@ -0,0 +1,121 @@
+// Copyright 2016-2020 Doug Moen
+// Licensed under the Apache License, version 2.0
+// See accompanying file LICENSE or https://www.apache.org/licenses/LICENSE-2.0
+
+#include <libcurv/viewer/disk_cache.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+
+namespace curv { namespace viewer {
+
+namespace fs = Filesystem;
+
+fs::path cache_path(const char* subdir, const Fnv1a& key)
+{
+    fs::path dir;
+    const char* XDG_CACHE_HOME = std::getenv("XDG_CACHE_HOME");
+    if (XDG_CACHE_HOME == nullptr || XDG_CACHE_HOME[0] == '\0') {
+        const char* HOME = std::getenv("HOME");
+        if (HOME == nullptr || HOME[0] == '\0')
+            return {};
+        dir = HOME;
+        dir /= ".cache";
+    } else {
+        dir = XDG_CACHE_HOME;
+    }
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin",
+        (unsigned long long) key.hash_);
+    return dir / "curv" / subdir / name;
+}
+
+bool read_cache_file(const fs::path& path, std::vector<char>& data)
+{
+    std::ifstream file(path.string(), std::ios::binary);
+    if (!file)
+        return false;
+    data.assign(std::istreambuf_iterator<char>(file),
+                std::istreambuf_iterator<char>());
+    if (data.empty())
+        return false;
+    // Mark the entry as recently used, for trim_cache.
+    boost::system::error_code ec;
+    fs::last_write_time(path, std::time(nullptr), ec);
+    return true;
+}
+
+// Delete the least recently used entries of a cache directory, until the
+// total size is within cache_size_limit.
+static void trim_cache(const fs::path& dir)
+{
+    struct Entry {
+        std::time_t mtime;
+        std::uintmax_t size;
+        fs::path path;
+    };
+    std::vector<Entry> entries;
+    std::uintmax_t total = 0;
+    boost::system::error_code ec;
+    for (fs::directory_iterator i(dir, ec), end; !ec && i != end; i.increment(ec)) {
+        const fs::path& p = i->path();
+        if (!fs::is_regular_file(p, ec))
+            continue;
+        Entry e{fs::last_write_time(p, ec), fs::file_size(p, ec), p};
+        if (ec)
+            continue;
+        total += e.size;
+        entries.push_back(std::move(e));
+    }
+    if (total <= cache_size_limit)
+        return;
+    std::sort(entries.begin(), entries.end(),
+        [](const Entry& a, const Entry& b) { return a.mtime < b.mtime; });
+    for (auto& e : entries) {
+        if (total <= cache_size_limit)
+            break;
+        fs::remove(e.path, ec);
+        if (!ec)
+            total -= e.size;
+    }
+}
+
+void write_cache_file(const fs::path& path, const std::vector<char>& data)
+{
+    // Write to a temporary file and rename it, so that a concurrent
+    // reader never sees a partially written entry.
+    boost::system::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+    if (ec)
+        return;
+    fs::path tmp = path;
+    tmp += fs::unique_path(".%%%%%%%%");
+    {
+        std::ofstream file(tmp.string(), std::ios::binary);
+        file.write(data.data(), data.size());
+        if (!file) {
+            file.close();
+            fs::remove(tmp, ec);
+            return;
+        }
+    }
+    fs::rename(tmp, path, ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+        return;
+    }
+    trim_cache(path.parent_path());
+}
+
+void remove_cache_file(const fs::path& path)
+{
+    boost::system::error_code ec;
+    fs::remove(path, ec);
+}
+
+}} // namespace
@@ -0,0 +1,67 @@
+// Copyright 2016-2020 Doug Moen
+// Licensed under the Apache License, version 2.0
+// See accompanying file LICENSE or https://www.apache.org/licenses/LICENSE-2.0
+
+#ifndef LIBCURV_VIEWER_DISK_CACHE_H
+#define LIBCURV_VIEWER_DISK_CACHE_H
+
+#include <libcurv/filesystem.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace curv { namespace viewer {
+
+// Support for caching compiled GPU programs on disk, so that viewing the
+// same shape again doesn't have to wait for the driver's compiler.
+// Each cache lives in a subdirectory of $XDG_CACHE_HOME/curv (by default,
+// ~/.cache/curv), with one file per program, named by a hash of everything
+// the compiled program depends on. Live mode writes a new entry for every
+// edit, so each cache is kept within cache_size_limit bytes by deleting the
+// least recently used entries.
+
+constexpr std::uintmax_t cache_size_limit = 64 * 1024 * 1024;
+
+// 64 bit FNV-1a. Unlike std::hash, the result is the same in every run,
+// which is required for an on-disk cache key.
+struct Fnv1a
+{
+    std::uint64_t hash_ = 0xcbf29ce484222325u;
+    void add(const char* str, std::size_t len)
+    {
+        for (std::size_t i = 0; i < len; ++i) {
+            hash_ ^= (unsigned char) str[i];
+            hash_ *= 0x100000001b3u;
+        }
+    }
+    // Strings are NUL terminated in the hash, so that adjacent strings
+    // can't run together.
+    void add(const char* str)
+    {
+        if (str == nullptr) str = "";
+        add(str, std::strlen(str) + 1);
+    }
+    void add(const std::string& str)
+    {
+        add(str.c_str(), str.size() + 1);
+    }
+};
+
+// The path of the cache file for `key` in the cache named `subdir`.
+// Returns an empty path if there is no cache directory (HOME is not set).
+Filesystem::path cache_path(const char* subdir, const Fnv1a& key);
+
+// Read an entire cache file, and mark it as recently used.
+// Returns false if it is missing or empty.
+bool read_cache_file(const Filesystem::path&, std::vector<char>& data);
+
+// Write a cache file, then trim its cache to cache_size_limit.
+// Errors are ignored: the cache is an optimization.
+void write_cache_file(const Filesystem::path&, const std::vector<char>& data);
+
+// Delete a cache file whose contents were rejected by the driver.
+void remove_cache_file(const Filesystem::path&);
+
+}} // namespace
+#endif // header guard
@@ -0,0 +1,105 @@
+// Copyright 2016-2020 Doug Moen
+// Licensed under the Apache License, version 2.0
+// See accompanying file LICENSE or https://www.apache.org/licenses/LICENSE-2.0
+
+#include <libcurv/viewer/gpu_timer.h>
+#include <algorithm>
+
+namespace curv { namespace viewer {
+
+const char* const GPU_Timer::pass_names[npasses] = {
+    "rays", "shape", "resolve", "imgui"
+};
+
+void GPU_Timer::init()
+{
+    // GL_TIME_ELAPSED queries are core in OpenGL 3.3.
+    enabled_ = GLAD_GL_VERSION_3_3;
+    if (!enabled_) return;
+    glGenQueries(nframes * npasses, &queries_[0][0]);
+    std::fill(&issued_[0][0], &issued_[0][0] + nframes*npasses, false);
+    std::fill(count_, count_ + npasses, 0);
+    frame_ = 0;
+    active_ = -1;
+}
+
+void GPU_Timer::close()
+{
+    if (!enabled_) return;
+    glDeleteQueries(nframes * npasses, &queries_[0][0]);
+    enabled_ = false;
+}
+
+void GPU_Timer::begin_frame()
+{
+    if (!enabled_) return;
+    frame_ = (frame_ + 1) % nframes;
+    for (int p = 0; p < npasses; ++p) {
+        if (!issued_[frame_][p]) continue;
+        issued_[frame_][p] = false;
+        // After nframes frames, the result is normally available.
+        // If not, drop it rather than stall.
+        GLuint available = 0;
+        glGetQueryObjectuiv(queries_[frame_][p],
+            GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) continue;
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(queries_[frame_][p], GL_QUERY_RESULT, &ns);
+        samples_[p][count_[p] % nsamples] = float(double(ns) * 1e-6);
+        ++count_[p];
+    }
+}
+
+void GPU_Timer::begin(Pass p)
+{
+    if (!enabled_) return;
+    glBeginQuery(GL_TIME_ELAPSED, queries_[frame_][p]);
+    active_ = p;
+}
+
+void GPU_Timer::end()
+{
+    if (!enabled_ || active_ < 0) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    issued_[frame_][active_] = true;
+    active_ = -1;
+}
+
+GPU_Timer::Stats GPU_Timer::stats(Pass p) const
+{
+    Stats st;
+    unsigned n = std::min(count_[p], unsigned(nsamples));
+    if (n == 0) return st;
+    float s[nsamples];
+    std::copy(samples_[p], samples_[p] + n, s);
+    auto pct = [&](double q) -> double {
+        float* nth = s + std::min(unsigned(q * n), n - 1);
+        std::nth_element(s, nth, s + n);
+        return *nth;
+    };
+    st.count = n;
+    st.p50 = pct(0.50);
+    st.p90 = pct(0.90);
+    st.p99 = pct(0.99);
+    return st;
+}
+
+void GPU_Timer::write_json(std::ostream& out) const
+{
+    out << "{\"gpu_ms\":{";
+    bool first = true;
+    for (int p = 0; p < npasses; ++p) {
+        auto st = stats(Pass(p));
+        if (st.count == 0) continue;
+        if (!first) out << ",";
+        first = false;
+        out << "\"" << pass_names[p] << "\":{"
+            << "\"n\":" << st.count
+            << ",\"p50\":" << st.p50
+            << ",\"p90\":" << st.p90
+            << ",\"p99\":" << st.p99 << "}";
+    }
+    out << "}}";
+}
+
+}} // namespace
@@ -0,0 +1,63 @@
+// Copyright 2016-2020 Doug Moen
+// Licensed under the Apache License, version 2.0
+// See accompanying file LICENSE or https://www.apache.org/licenses/LICENSE-2.0
+
+#ifndef LIBCURV_VIEWER_GPU_TIMER_H
+#define LIBCURV_VIEWER_GPU_TIMER_H
+
+#include <libcurv/viewer/glfw.h>
+#include <ostream>
+
+namespace curv { namespace viewer {
+
+// Measures the GPU time taken by each render pass, using GL_TIME_ELAPSED
+// queries. Query results are read back several frames later, so that the
+// CPU never waits for the GPU. The timings of the most recent frames are
+// kept, for reporting percentiles.
+struct GPU_Timer
+{
+    enum Pass {
+        rays,     // first pass of the multipass renderer (fpFbo_)
+        shape,    // main SDF pass
+        resolve,  // upscaling or accumulation resolve
+        imgui,
+        npasses
+    };
+    static const char* const pass_names[npasses];
+
+    // A query is read back this many frames after it is issued.
+    static constexpr int nframes = 4;
+    // Number of timings kept for each pass.
+    static constexpr int nsamples = 128;
+
+    struct Stats {
+        unsigned count = 0; // # of timings; the others are 0 if none
+        double p50 = 0.0, p90 = 0.0, p99 = 0.0; // milliseconds
+    };
+
+    void init();
+    void close();
+
+    // Call at the start of each frame: collects results from old queries.
+    void begin_frame();
+    // Bracket the GL commands of a render pass. Passes can't be nested.
+    void begin(Pass);
+    void end();
+
+    Stats stats(Pass) const;
+
+    // Print the percentiles of all passes as a single line of JSON.
+    void write_json(std::ostream&) const;
+
+private:
+    bool enabled_ = false;
+    GLuint queries_[nframes][npasses] = {};
+    bool issued_[nframes][npasses] = {};
+    int frame_ = 0;
+    int active_ = -1;
+    float samples_[npasses][nsamples] = {};
+    unsigned count_[npasses] = {};
+};
+
+}} // namespace
+#endif // header guard
@@ -1,6 +1,7 @@
 #include "shader.h"
 
 #include "text.h"
+#include <libcurv/viewer/disk_cache.h>
 #include <cstring>
 #include <chrono>
 #include <algorithm>
@@ -45,49 +46,169 @@ bool find_id(const std::string& program, const char* id) {
     return std::strstr(program.c_str(), id) != 0;
 }
 
-bool Shader::load(const std::string& _fragmentSrc, const std::string& _vertexSrc, bool _verbose) {
-    std::chrono::time_point<std::chrono::steady_clock> start_time, end_time;
-    start_time = std::chrono::steady_clock::now();
-
-    m_vertexShader = compileShader(_vertexSrc, GL_VERTEX_SHADER, _verbose);
+// Linked programs are cached on disk using glGetProgramBinary, in the
+// "shaders" cache (see disk_cache.h). Each file holds the binary format enum
+// followed by the program binary. The key includes the GL vendor, renderer
+// and version strings, so a driver upgrade or a change of GPU misses the
+// cache instead of loading an incompatible binary.
+namespace {
 
-    m_fragmentShader = compileShader(_fragmentSrc, GL_FRAGMENT_SHADER, _verbose);
+namespace fs = curv::Filesystem;
+using curv::viewer::Fnv1a;
 
-    if(!m_fragmentShader || !m_vertexShader) {
+bool programBinarySupported()
+{
+    if (!GLAD_GL_ARB_get_program_binary)
         return false;
-    } else {
-        m_backbuffer = find_id(_fragmentSrc, "u_backbuffer")
-               || find_id(_vertexSrc, "u_backbuffer");
-        if (!m_time)
-            m_time = find_id(_fragmentSrc, "u_time")
-               || find_id(_vertexSrc, "u_time");
-        if (!m_delta)
-            m_delta = find_id(_fragmentSrc, "u_delta")
-               || find_id(_vertexSrc, "u_delta");
-        if (!m_date)
-            m_date = find_id(_fragmentSrc, "u_date")
-               || find_id(_vertexSrc, "u_date");
-        m_mouse = find_id(_fragmentSrc, "u_mouse")
-            || find_id(_vertexSrc, "u_mouse");
-        m_view2d = find_id(_fragmentSrc, "u_view2d")
-            || find_id(_vertexSrc, "u_view2d");
-        m_view3d = (find_id(_fragmentSrc, "u_eye3d")
-            || find_id(_fragmentSrc, "u_centre3d")
-            || find_id(_fragmentSrc, "u_up3d")
-            || find_id(_vertexSrc, "u_eye3d")
-            || find_id(_vertexSrc, "u_centre3d")
-            || find_id(_vertexSrc, "u_up3d"));
+    GLint nformats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nformats);
+    return nformats > 0;
+}
+
+fs::path programCachePath(
+    const std::string& _fragmentSrc, const std::string& _vertexSrc)
+{
+    Fnv1a key;
+    key.add((const char*) glGetString(GL_VENDOR));
+    key.add((const char*) glGetString(GL_RENDERER));
+    key.add((const char*) glGetString(GL_VERSION));
+    key.add(curv::geom::glsl_version);
+#ifdef MULTIPASS_RENDER
+    key.add("MULTIPASS_RENDER");
+#endif
+    key.add(_vertexSrc);
+    key.add(_fragmentSrc);
+    return curv::viewer::cache_path("shaders", key);
+}
+
+// Returns a linked program, or 0 if the cache entry is missing or the
+// driver rejects the binary (in which case the entry is deleted).
+GLuint loadCachedProgram(const fs::path& _path)
+{
+    std::vector<char> data;
+    if (!curv::viewer::read_cache_file(_path, data))
+        return 0;
+    if (data.size() <= sizeof(GLenum))
+        return 0;
+    GLenum format;
+    std::memcpy(&format, data.data(), sizeof(GLenum));
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, format,
+        data.data() + sizeof(GLenum), GLsizei(data.size() - sizeof(GLenum)));
+    GLint isLinked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
+    if (isLinked == GL_FALSE) {
+        glDeleteProgram(program);
+        curv::viewer::remove_cache_file(_path);
+        return 0;
+    }
+    return program;
+}
+
+void saveCachedProgram(GLuint _program, const fs::path& _path)
+{
+    GLint length = 0;
+    glGetProgramiv(_program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    std::vector<char> data(sizeof(GLenum) + length);
+    GLenum format = 0;
+    glGetProgramBinary(_program, length, &length, &format,
+        data.data() + sizeof(GLenum));
+    std::memcpy(data.data(), &format, sizeof(GLenum));
+    data.resize(sizeof(GLenum) + length);
+    curv::viewer::write_cache_file(_path, data);
+}
+
+} // namespace
+
+bool Shader::load(const std::string& _fragmentSrc, const std::string& _vertexSrc, bool _verbose) {
+    beginLoad(_fragmentSrc, _vertexSrc, _verbose);
+    return endLoad();
+}
+
+bool Shader::parallelCompileSupported() {
+    return GLAD_GL_KHR_parallel_shader_compile != 0;
+}
+
+void Shader::beginLoad(const std::string& _fragmentSrc, const std::string& _vertexSrc, bool _verbose) {
+    m_loadStart = std::chrono::steady_clock::now();
+    m_verbose = _verbose;
+    m_fragmentSrc = _fragmentSrc;
+    m_vertexSrc = _vertexSrc;
+
+    findUniforms(_fragmentSrc, _vertexSrc);
+
+    m_useCache = programBinarySupported();
+    m_cachePath.clear();
+    if (m_useCache) {
+        // The key covers the prolog and epilog, which change between releases.
+        m_cachePath = programCachePath(
+            prolog(_fragmentSrc, GL_FRAGMENT_SHADER) + _fragmentSrc
+                + epilog(_fragmentSrc, GL_FRAGMENT_SHADER),
+            prolog(_vertexSrc, GL_VERTEX_SHADER) + _vertexSrc
+                + epilog(_vertexSrc, GL_VERTEX_SHADER)).string();
     }
+    if (!m_cachePath.empty()) {
+        GLuint program = loadCachedProgram(m_cachePath);
+        if (program != 0) {
+            m_program = program;
+            m_vertexShader = 0;
+            m_fragmentShader = 0;
+            m_cached = true;
+            return;
+        }
+    }
+    m_cached = false;
+
+    // With GL_KHR_parallel_shader_compile, these calls return immediately,
+    // and the driver compiles and links on its own threads.
+    m_vertexShader = compileShader(_vertexSrc, GL_VERTEX_SHADER);
+    m_fragmentShader = compileShader(_fragmentSrc, GL_FRAGMENT_SHADER);
 
     m_program = glCreateProgram();
 
     glAttachShader(m_program, m_vertexShader);
     glAttachShader(m_program, m_fragmentShader);
     glBindFragDataLocation(m_program, 0, "oFragColour");
+    if (m_useCache)
+        glProgramParameteri(m_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(m_program);
+}
 
-    end_time = std::chrono::steady_clock::now();
-    std::chrono::duration<double> load_time = end_time - start_time;
+bool Shader::isLoaded() const {
+    if (m_cached || !parallelCompileSupported())
+        return true;
+    GLint done = GL_TRUE;
+    glGetProgramiv(m_program, GL_COMPLETION_STATUS_KHR, &done);
+    return done != GL_FALSE;
+}
+
+bool Shader::endLoad() {
+    std::chrono::time_point<std::chrono::steady_clock> end_time =
+        std::chrono::steady_clock::now();
+    std::chrono::duration<double> load_time = end_time - m_loadStart;
+
+    if (m_cached) {
+        if (m_verbose) {
+            std::cerr << "shader load time: " << load_time.count()
+                << "s (cached)" << std::endl;
+        }
+        return true;
+    }
+
+    bool vertOk = checkShader(m_vertexShader, m_vertexSrc, GL_VERTEX_SHADER, m_verbose);
+    bool fragOk = checkShader(m_fragmentShader, m_fragmentSrc, GL_FRAGMENT_SHADER, m_verbose);
+    if (!vertOk || !fragOk) {
+        glDeleteProgram(m_program);
+        glDeleteShader(m_vertexShader);
+        glDeleteShader(m_fragmentShader);
+        m_program = 0;
+        m_vertexShader = 0;
+        m_fragmentShader = 0;
+        return false;
+    }
 
     GLint isLinked;
     glGetProgramiv(m_program, GL_LINK_STATUS, &isLinked);
@@ -105,22 +226,33 @@ bool Shader::load(const std::string& _fragmentSrc, const std::string& _vertexSrc
             std::size_t start = error.find("line ")+5;
             std::size_t end = error.find_last_of(")");
             std::string lineNum = error.substr(start,end-start);
-            std::cerr << (unsigned)toInt(lineNum) << ": " << getLineNumber(_fragmentSrc,(unsigned)toInt(lineNum)) << std::endl;
+            std::cerr << (unsigned)toInt(lineNum) << ": " << getLineNumber(m_fragmentSrc,(unsigned)toInt(lineNum)) << std::endl;
         }
         glDeleteProgram(m_program);
+        glDeleteShader(m_vertexShader);
+        glDeleteShader(m_fragmentShader);
+        m_program = 0;
+        m_vertexShader = 0;
+        m_fragmentShader = 0;
         return false;
     } else {
+        // The shaders are freed along with the program.
         glDeleteShader(m_vertexShader);
         glDeleteShader(m_fragmentShader);
+        m_vertexShader = 0;
+        m_fragmentShader = 0;
+
+        if (!m_cachePath.empty())
+            saveCachedProgram(m_program, m_cachePath);
 
-        if (_verbose) {
+        if (m_verbose) {
             std::cerr << "shader load time: " << load_time.count() << "s";
-#ifdef GL_PROGRAM_BINARY_LENGTH
-            GLint proglen = 0;
-            glGetProgramiv(m_program, GL_PROGRAM_BINARY_LENGTH, &proglen);
-            if (proglen > 0)
-                std::cerr << " size: " << proglen;
-#endif
+            if (m_useCache) {
+                GLint proglen = 0;
+                glGetProgramiv(m_program, GL_PROGRAM_BINARY_LENGTH, &proglen);
+                if (proglen > 0)
+                    std::cerr << " size: " << proglen;
+            }
 #ifdef GL_PROGRAM_INSTRUCTIONS_ARB
             GLint icount = 0;
             glGetProgramivARB(m_program, GL_PROGRAM_INSTRUCTIONS_ARB, &icount);
@@ -134,6 +266,73 @@ bool Shader::load(const std::string& _fragmentSrc, const std::string& _vertexSrc
     }
 }
 
+void Shader::unload() {
+    // The shaders of a compile that was cancelled before endLoad.
+    if (m_vertexShader != 0)
+        glDeleteShader(m_vertexShader);
+    if (m_fragmentShader != 0)
+        glDeleteShader(m_fragmentShader);
+    if (m_program != 0)
+        glDeleteProgram(m_program);
+    m_program = 0;
+    m_vertexShader = 0;
+    m_fragmentShader = 0;
+}
+
+void Shader::swap(Shader& _other) {
+    std::swap(m_program, _other.m_program);
+    std::swap(m_fragmentShader, _other.m_fragmentShader);
+    std::swap(m_vertexShader, _other.m_vertexShader);
+    std::swap(m_backbuffer, _other.m_backbuffer);
+    std::swap(m_time, _other.m_time);
+    std::swap(m_delta, _other.m_delta);
+    std::swap(m_date, _other.m_date);
+    std::swap(m_mouse, _other.m_mouse);
+    std::swap(m_imouse, _other.m_imouse);
+    std::swap(m_view2d, _other.m_view2d);
+    std::swap(m_view3d, _other.m_view3d);
+    std::swap(m_fragmentSrc, _other.m_fragmentSrc);
+    std::swap(m_vertexSrc, _other.m_vertexSrc);
+    std::swap(m_cachePath, _other.m_cachePath);
+    std::swap(m_loadStart, _other.m_loadStart);
+    std::swap(m_useCache, _other.m_useCache);
+    std::swap(m_cached, _other.m_cached);
+    std::swap(m_verbose, _other.m_verbose);
+}
+
+// Determine which of the standard uniforms the program uses.
+// This is done before compiling, since compileShader emits declarations
+// for the shadertoy.com uniforms that are used.
+void Shader::findUniforms(const std::string& _fragmentSrc, const std::string& _vertexSrc) {
+    if (find_id(_fragmentSrc, "mainImage")) {
+        m_time = true;
+        m_delta = find_id(_fragmentSrc, "iTimeDelta");
+        m_date = find_id(_fragmentSrc, "iDate");
+        m_imouse = find_id(_fragmentSrc, "iMouse");
+    }
+    m_backbuffer = find_id(_fragmentSrc, "u_backbuffer")
+           || find_id(_vertexSrc, "u_backbuffer");
+    if (!m_time)
+        m_time = find_id(_fragmentSrc, "u_time")
+           || find_id(_vertexSrc, "u_time");
+    if (!m_delta)
+        m_delta = find_id(_fragmentSrc, "u_delta")
+           || find_id(_vertexSrc, "u_delta");
+    if (!m_date)
+        m_date = find_id(_fragmentSrc, "u_date")
+           || find_id(_vertexSrc, "u_date");
+    m_mouse = find_id(_fragmentSrc, "u_mouse")
+        || find_id(_vertexSrc, "u_mouse");
+    m_view2d = find_id(_fragmentSrc, "u_view2d")
+        || find_id(_vertexSrc, "u_view2d");
+    m_view3d = (find_id(_fragmentSrc, "u_eye3d")
+        || find_id(_fragmentSrc, "u_centre3d")
+        || find_id(_fragmentSrc, "u_up3d")
+        || find_id(_vertexSrc, "u_eye3d")
+        || find_id(_vertexSrc, "u_centre3d")
+        || find_id(_vertexSrc, "u_up3d"));
+}
+
 const GLint Shader::getAttribLocation(const std::string& _attribute) const {
     return glGetAttribLocation(m_program, _attribute.c_str());
 }
@@ -150,11 +349,11 @@ bool Shader::isInUse() const {
     return (getProgram() == (GLuint)currentProgram);
 }
 
-GLuint Shader::compileShader(
-    const std::string& _src, GLenum _type, bool verbose)
+// The source code is wrapped in a prolog and epilog, which define the
+// standard uniforms and support shadertoy.com image shaders.
+std::string Shader::prolog(const std::string& _src, GLenum _type) const
 {
     std::string prolog = "";
-    const char* epilog = "";
 
     prolog += curv::geom::glsl_version;
     prolog += "\n#define GLSLVIEWER 1\n";
@@ -169,51 +368,67 @@ GLuint Shader::compileShader(
         prolog +=
             "uniform vec2 u_resolution;\n"
             "#define iResolution vec3(u_resolution, 1.0)\n"
+            "// When an image is rendered in tiles, u_resolution is the size\n"
+            "// of the image, and this is the position of the current tile.\n"
+            "uniform vec2 u_tile_offset;\n"
             "out vec4 oFragColour;\n"
             "\n";
-        m_time = true;
         prolog +=
             "uniform float u_time;\n"
             "#define iGlobalTime u_time\n"
             "#define iTime u_time\n"
             "\n";
-        m_delta = find_id(_src, "iTimeDelta");
         if (m_delta) {
             prolog +=
                 "uniform float u_delta;\n"
                 "#define iTimeDelta u_delta\n"
                 "\n";
         }
-        m_date = find_id(_src, "iDate");
         if (m_date) {
             prolog +=
                 "uniform vec4 u_date;\n"
                 "#define iDate u_date\n"
                 "\n";
         }
-        m_imouse = find_id(_src, "iMouse");
         if (m_imouse) {
             prolog +=
                 "uniform vec4 iMouse;\n"
                 "\n";
         }
-        epilog =
+    }
+    return prolog;
+}
+
+const char* Shader::epilog(const std::string& _src, GLenum _type) const
+{
+    if (_type == GL_FRAGMENT_SHADER && find_id(_src, "mainImage")) {
+        return
             "\n"
             "void main(void) {\n"
-            "    mainImage(oFragColour, gl_FragCoord.st);\n"
+            "    mainImage(oFragColour, gl_FragCoord.st + u_tile_offset);\n"
             "}\n";
     }
+    return "";
+}
 
+GLuint Shader::compileShader(const std::string& _src, GLenum _type)
+{
+    std::string prolog = this->prolog(_src, _type);
     const GLchar* sources[3] = {
         (const GLchar*) prolog.c_str(),
         (const GLchar*) _src.c_str(),
-        (const GLchar*) epilog,
+        (const GLchar*) epilog(_src, _type),
     };
 
     GLuint shader = glCreateShader(_type);
     glShaderSource(shader, 3, sources, NULL);
     glCompileShader(shader);
+    return shader;
+}
 
+bool Shader::checkShader(
+    GLuint shader, const std::string& _src, GLenum _type, bool verbose)
+{
     GLint isCompiled;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &isCompiled);
 
@@ -232,16 +447,11 @@ GLuint Shader::compileShader(
         }
         std::cerr << "shader:\n" << &infoLog[0] << std::endl
             << "---source---\n"
-            << prolog << _src << epilog
+            << prolog(_src, _type) << _src << epilog(_src, _type)
             << "---EOF---\n";
     }
 
-    if (isCompiled == GL_FALSE) {
-        glDeleteShader(shader);
-        return 0;
-    }
-
-    return shader;
+    return isCompiled != GL_FALSE;
 }
 
 void Shader::detach(GLenum _type)
@@ -249,13 +459,15 @@ void Shader::detach(GLenum _type)
     bool vert = (GL_VERTEX_SHADER & _type) == GL_VERTEX_SHADER;
     bool frag = (GL_FRAGMENT_SHADER & _type) == GL_FRAGMENT_SHADER;
 
-    if (vert) {
+    if (vert && m_vertexShader) {
         glDeleteShader(m_vertexShader);
         glDetachShader(m_program, m_vertexShader);
+        m_vertexShader = 0;
     }
-    if (frag) {
+    if (frag && m_fragmentShader) {
         glDeleteShader(m_fragmentShader);
         glDetachShader(m_program, m_fragmentShader);
+        m_fragmentShader = 0;
     }
 }
 
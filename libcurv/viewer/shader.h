@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <string>
 #include <vector>
 
@@ -34,6 +35,20 @@ public:
     const   GLint   getAttribLocation(const std::string& _attribute) const;
     bool    load(const std::string& _fragmentSrc, const std::string& _vertexSrc, bool _verbose = false);
 
+    // Load in two steps, so that the caller can keep rendering while the
+    // driver compiles the program. beginLoad() starts compiling and linking,
+    // isLoaded() polls for completion, and endLoad() reports errors and
+    // returns the same result as load(). Without GL_KHR_parallel_shader_compile,
+    // isLoaded() is always true, and endLoad() blocks.
+    static bool parallelCompileSupported();
+    void    beginLoad(const std::string& _fragmentSrc, const std::string& _vertexSrc, bool _verbose = false);
+    bool    isLoaded() const;
+    bool    endLoad();
+
+    // Delete the program. The GL context it was loaded in must be current.
+    void    unload();
+    void    swap(Shader& _other);
+
     void    setUniform(const std::string& _name, int _x);
 
     void    setUniform(const std::string& _name, float _x);
@@ -58,7 +73,11 @@ public:
 
 private:
 
-    GLuint  compileShader(const std::string& src, GLenum type, bool verbose);
+    std::string prolog(const std::string& src, GLenum type) const;
+    const char* epilog(const std::string& src, GLenum type) const;
+    GLuint  compileShader(const std::string& src, GLenum type);
+    bool    checkShader(GLuint shader, const std::string& src, GLenum type, bool verbose);
+    void    findUniforms(const std::string& _fragmentSrc, const std::string& _vertexSrc);
     GLint   getUniformLocation(const std::string& _uniformName) const;
 
     GLuint  m_program;
@@ -73,4 +92,13 @@ private:
     bool    m_imouse;
     bool    m_view2d;
     bool    m_view3d;
+
+    // State of the most recent load.
+    std::string m_fragmentSrc;
+    std::string m_vertexSrc;
+    std::string m_cachePath;
+    std::chrono::steady_clock::time_point m_loadStart;
+    bool    m_useCache = false;
+    bool    m_cached = false;
+    bool    m_verbose = false;
 };
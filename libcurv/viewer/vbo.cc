@@ -1,11 +1,12 @@
 #include "vbo.h"
+#include <algorithm>
 #include <iostream>
 
-Vbo::Vbo(VertexLayout* _vertexLayout, GLenum _drawMode) : m_vertexLayout(_vertexLayout), m_glVertexBuffer(0), m_nVertices(0), m_glIndexBuffer(0), m_nIndices(0), m_isUploaded(false) {
+Vbo::Vbo(VertexLayout* _vertexLayout, GLenum _drawMode) : m_vertexLayout(_vertexLayout), m_glVertexBuffer(0), m_nVertices(0), m_vertexCapacity(0), m_isMapped(false), m_glIndexBuffer(0), m_nIndices(0), m_isUploaded(false) {
     setDrawMode(_drawMode);
 }
 
-Vbo::Vbo() : m_vertexLayout(NULL), m_glVertexBuffer(0), m_nVertices(0), m_glIndexBuffer(0), m_nIndices(0), m_isUploaded(false) {
+Vbo::Vbo() : m_vertexLayout(NULL), m_glVertexBuffer(0), m_nVertices(0), m_vertexCapacity(0), m_isMapped(false), m_glIndexBuffer(0), m_nIndices(0), m_isUploaded(false) {
 }
 
 Vbo::~Vbo() {
@@ -54,33 +55,21 @@ void Vbo::addVertices(GLbyte* _vertices, int _nVertices) {
         return;
     }
 
-    // Only add up to 65535 vertices, any more will overflow our 16-bit indices
-    int indexSpace = MAX_INDEX_VALUE - m_nVertices;
-    if (_nVertices > indexSpace) {
-        _nVertices = indexSpace;
-        std::cout << "WARNING: Tried to add more vertices than available in index space" << std::endl;
-    }
-
     int vertexBytes = m_vertexLayout->getStride() * _nVertices;
     m_vertexData.insert(m_vertexData.end(), _vertices, _vertices + vertexBytes);
     m_nVertices += _nVertices;
 }
 
-void Vbo::addIndex(GLushort* _index) {
+void Vbo::addIndex(GLuint* _index) {
     addIndices(_index, 1);
 }
 
-void Vbo::addIndices(GLushort* _indices, int _nIndices) {
+void Vbo::addIndices(GLuint* _indices, int _nIndices) {
     if (m_isUploaded) {
         std::cout << "Vbo cannot add indices after upload!" << std::endl;
         return;
     }
 
-    if (m_nVertices >= MAX_INDEX_VALUE) {
-        std::cout << "WARNING: Vertex buffer full, not adding indices" << std::endl;
-        return;
-    }
-
     m_indices.insert(m_indices.end(), _indices, _indices + _nIndices);
     m_nIndices += _nIndices;
 }
@@ -95,6 +84,7 @@ void Vbo::upload() {
         // Buffer vertex data
         glBindBuffer(GL_ARRAY_BUFFER, m_glVertexBuffer);
         glBufferData(GL_ARRAY_BUFFER, m_vertexData.size(), m_vertexData.data(), GL_STATIC_DRAW);
+        m_vertexCapacity = m_vertexData.size();
     }
 
     if (m_nIndices > 0) {
@@ -105,7 +95,7 @@ void Vbo::upload() {
 
         // Buffer element index data
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_glIndexBuffer);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(GLushort), m_indices.data(), GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(GLuint), m_indices.data(), GL_STATIC_DRAW);
     }
 
     m_vertexData.clear();
@@ -114,6 +104,59 @@ void Vbo::upload() {
     m_isUploaded = true;
 }
 
+GLbyte* Vbo::mapVertices(int _nVertices) {
+    if (m_isMapped) {
+        std::cout << "Vbo vertices are already mapped!" << std::endl;
+        return nullptr;
+    }
+
+    if (m_glVertexBuffer == 0) {
+        glGenBuffers(1, &m_glVertexBuffer);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, m_glVertexBuffer);
+
+    // Grow the buffer geometrically, so that refilling it with a similar
+    // amount of geometry doesn't reallocate
+    GLsizeiptr bytes = GLsizeiptr(m_vertexLayout->getStride()) * _nVertices;
+    if (bytes > m_vertexCapacity) {
+        m_vertexCapacity = std::max(bytes, 2 * m_vertexCapacity);
+        glBufferData(GL_ARRAY_BUFFER, m_vertexCapacity, NULL, GL_DYNAMIC_DRAW);
+    }
+
+    m_vertexData.clear();
+    m_indices.clear();
+    m_nIndices = 0;
+    m_nVertices = _nVertices;
+    m_isUploaded = true;
+    if (bytes == 0) {
+        return nullptr;
+    }
+
+    // The old contents are discarded, so the driver doesn't have to wait
+    // for draw calls that still use them
+    GLbyte* ptr = (GLbyte*) glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (ptr == nullptr) {
+        std::cout << "Vbo failed to map the vertex buffer!" << std::endl;
+        m_nVertices = 0;
+    }
+    m_isMapped = (ptr != nullptr);
+    return ptr;
+}
+
+void Vbo::unmapVertices() {
+    if (!m_isMapped) {
+        return;
+    }
+    m_isMapped = false;
+    glBindBuffer(GL_ARRAY_BUFFER, m_glVertexBuffer);
+    if (glUnmapBuffer(GL_ARRAY_BUFFER) == GL_FALSE) {
+        // The contents were lost while mapped, eg by a video mode change
+        std::cout << "WARNING: Vbo vertex data was lost, not drawing it" << std::endl;
+        m_nVertices = 0;
+    }
+}
+
 void Vbo::draw(const Shader* _shader) {
 
     // Ensure that geometry is buffered into GPU
@@ -138,7 +181,7 @@ void Vbo::draw(const Shader* _shader) {
 
     // Draw as elements or arrays
     if (m_nIndices > 0) {
-        glDrawElements(m_drawMode, m_nIndices, GL_UNSIGNED_SHORT, 0);
+        glDrawElements(m_drawMode, m_nIndices, GL_UNSIGNED_INT, 0);
     } else if (m_nVertices > 0) {
         glDrawArrays(m_drawMode, 0, m_nVertices);
     }
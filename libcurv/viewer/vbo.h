@@ -5,8 +5,6 @@
 #include <libcurv/viewer/glfw.h>
 #include "vertexLayout.h"
 
-#define MAX_INDEX_VALUE 65535
-
 /*
  * Vbo - Drawable collection of geometry contained in a vertex buffer and (optionally) an index buffer
  */
@@ -42,15 +40,24 @@ public:
     void addVertices(GLbyte* _vertices, int _nVertices);
 
     /*
-     * Adds a single index to the mesh; indices are unsigned shorts
+     * Adds a single index to the mesh; indices are 32 bit unsigned ints
      */
-    void addIndex(GLushort* _index);
+    void addIndex(GLuint* _index);
 
     /*
      * Adds _nIndices indices to the mesh; _indices must be a pointer to the beginning of a contiguous
-     * block of _nIndices unsigned short indices
+     * block of _nIndices unsigned int indices
      */
-    void addIndices(GLushort* _indices, int _nIndices);
+    void addIndices(GLuint* _indices, int _nIndices);
+
+    /*
+     * Streaming alternative to addVertices and upload: maps space for _nVertices vertices in the
+     * OpenGL vertex buffer, and returns a pointer for writing them, structured according to the
+     * VertexLayout. Call unmapVertices() when done. This replaces any previous geometry, which is
+     * drawn without indices. The buffer is kept between calls, and only reallocated when it grows.
+     */
+    GLbyte* mapVertices(int _nVertices);
+    void unmapVertices();
 
     int numIndices() const { return m_indices.size(); };
     int numVertices() const { return m_nVertices; };
@@ -76,7 +83,10 @@ private:
     GLuint  m_glVertexBuffer;
     int     m_nVertices;
 
-    std::vector<GLushort> m_indices;
+    GLsizeiptr m_vertexCapacity;
+    bool    m_isMapped;
+
+    std::vector<GLuint> m_indices;
     GLuint  m_glIndexBuffer;
     int     m_nIndices;
 
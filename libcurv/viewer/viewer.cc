@@ -9,6 +9,8 @@
 
 #include <libcurv/viewer/viewer.h>
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <sstream>
 #include <chrono>
@@ -17,6 +19,7 @@
 #include <libcurv/context.h>
 #include <libcurv/die.h>
 #include <libcurv/exception.h>
+#include <libcurv/glsl.h>
 #include <libcurv/string.h>
 
 #define GLM_ENABLE_EXPERIMENTAL
@@ -66,6 +69,47 @@ Viewer::set_shape_no_hud(const Shape_Program& shape, const Rays_Program& rays, c
 
 void
 Viewer::set_shape(Viewed_Shape shape)
+{
+    if (is_open() && !error_ && !shape_.empty()) {
+        // If the new shape compiles to the same shader program (eg, live mode
+        // re-evaluated the program after an edit that didn't change the
+        // shape), then keep the loaded shader and the current picker state.
+        if (shape.same_program(shape_)) {
+            cancel_pending_shape();
+            return;
+        }
+        if (pending_ && shape.same_program(pending_shape_))
+            return;
+    }
+
+    if (is_open() && Shader::parallelCompileSupported()) {
+        // Compile the new shader in the background. The current shape is
+        // rendered until the new program is linked, then draw_frame()
+        // switches to the new shape.
+        cancel_pending_shape();
+        pending_shape_ = std::move(shape);
+        pending_shader_.beginLoad(pending_shape_.frag_, vertSource_,
+            config_.verbose_);
+        pending_ = true;
+        return;
+    }
+
+    cancel_pending_shape();
+    install_shape(std::move(shape));
+    if (is_open()) {
+        error_ = false;
+        num_errors_ = 0;
+        shader_.detach(GL_FRAGMENT_SHADER | GL_VERTEX_SHADER);
+        if (!shader_.load(shape_.frag_, vertSource_, config_.verbose_))
+            error_ = true;
+
+
+        fps_.reset();
+    }
+}
+
+void
+Viewer::install_shape(Viewed_Shape shape)
 {
     // preserve picker state
     if (!shape_.param_.empty()) {
@@ -84,6 +128,15 @@ Viewer::set_shape(Viewed_Shape shape)
 
     shape_ = std::move(shape);
     hud_ = !shape_.param_.empty();
+
+    // The AA factor is compiled into the shader, as "#define AA <n>".
+    auto aa = shape_.frag_.find("#define AA ");
+    accum_.aa_ = aa == std::string::npos
+        ? 1 : std::max(1, std::atoi(shape_.frag_.c_str() + aa + 11));
+    // Every Curv frag shader reads the time (iTime) in mainImage, so ask
+    // whether the dist and colour functions use it.
+    accum_.animated_ = glsl_uses_time(shape_.frag_);
+    accum_.samples_ = 0;
   #if 0
     // describe sliders on stderr (TODO: remove debug code)
     for (auto& i : shape_.param_) {
@@ -94,15 +147,44 @@ Viewer::set_shape(Viewed_Shape shape)
         std::cerr << "\n";
     }
   #endif
-    if (is_open()) {
-        error_ = false;
-        num_errors_ = 0;
-        shader_.detach(GL_FRAGMENT_SHADER | GL_VERTEX_SHADER);
-        if (!shader_.load(shape_.frag_, vertSource_, config_.verbose_))
-            error_ = true;
+}
 
+// Called once per frame. If a background shader compile has finished,
+// then atomically switch to the new shader and shape.
+void
+Viewer::poll_pending_shape()
+{
+    if (!pending_ || !pending_shader_.isLoaded())
+        return;
+    pending_ = false;
+    bool ok = pending_shader_.endLoad();
+    shader_.swap(pending_shader_);
+    pending_shader_.unload();
+    install_shape(std::move(pending_shape_));
+    pending_shape_ = Viewed_Shape();
+    error_ = !ok;
+    num_errors_ = 0;
+#ifdef CALC_RAY
+    if (pending_rays_) {
+        pending_rays_ = false;
+        install_rays(std::move(pending_tshape_), pending_bbox_);
+        pending_tshape_ = Traced_Shape();
+    }
+#endif
+    fps_.reset();
+}
 
-        fps_.reset();
+void
+Viewer::cancel_pending_shape()
+{
+    if (pending_) {
+        pending_ = false;
+        pending_shader_.unload();
+        pending_shape_ = Viewed_Shape();
+#ifdef CALC_RAY
+        pending_rays_ = false;
+        pending_tshape_ = Traced_Shape();
+#endif
     }
 }
 
@@ -110,48 +192,10 @@ Viewer::set_shape(Viewed_Shape shape)
 void
 Viewer::set_shape(Viewed_Shape shape, Traced_Shape tshape)
 {
-    set_shape(shape);
-    tshape_ = std::move(tshape);
-    if (!rayCalc_.isInit())
-    {
-        rayCalc_.init();
-    }
-
-    Mesh mesh;
-    if (rayCalc_.isInit())
-    {
-        //Input viewer uniforms.
-        //Input parameters.
-        RayCalcRetCode res = rayCalc_.setParameters(tshape_);
-        if (res != RayCalcRetCode::OK) {
-            std::cout << "Error compiling OpenCL code." << std::endl;
-            die("Death because of error compiling OpenCL code.");
-        }
-        //Input condition parameters.
-        //Calculate rays.
-        RayCalcResult result = rayCalc_.calculate(tshape_);
-        //Convert rays to lines.
-        //std::cout << "Drawing lines...." << std::endl;
-        mesh.setDrawMode(GL_LINES);
-        for (auto r : result.rays) {
-            //std::cout << "Line: (" << std::to_string(r.pos.x)
-            //          << ", " << std::to_string(r.pos.y)
-            //          << ", " << std::to_string(r.pos.z)
-            //          << ") -> (" << std::to_string((r.pos + r.dir).x)
-            //          << ", " << std::to_string((r.pos + r.dir).y)
-            //          << ", " << std::to_string((r.pos + r.dir).z)
-            //          << ")" << std::endl;
-            mesh.addVertex(r.pos);
-            mesh.addVertex(r.pos + r.dir);
-            mesh.addColor(r.colour);
-            mesh.addColor(r.colour);
-        }
-    }
-#ifdef MULTIPASS_RENDER
-    fpVbo_ = mesh.getVbo();
-    //Find bbox_min, bbox_max definition statements.
     std::string bbox_str;
-    std::istringstream iss(shape_.frag_);
+#ifdef MULTIPASS_RENDER
+    // Find bbox_min, bbox_max definition statements in the new shape.
+    std::istringstream iss(shape.frag_);
     bool is_2d = false;
     bool is_3d = false;
     for (std::string line; std::getline(iss, line); )
@@ -173,14 +217,80 @@ Viewer::set_shape(Viewed_Shape shape, Traced_Shape tshape)
     } else {
         die("Error parsing frag shader code. No bounding box values detected.");
     }
+#endif
+
+    if (!rayCalc_.isInit())
+    {
+        rayCalc_.init();
+    }
+    set_shape(std::move(shape));
+    if (pending_) {
+        // The shape is being compiled in the background. The old rays are
+        // drawn until poll_pending_shape() switches to the new shape.
+        pending_tshape_ = std::move(tshape);
+        pending_bbox_ = std::move(bbox_str);
+        pending_rays_ = true;
+        return;
+    }
+    install_rays(std::move(tshape), bbox_str);
+}
+
+void
+Viewer::install_rays(Traced_Shape tshape, const std::string& bbox_str)
+{
+    tshape_ = std::move(tshape);
+#ifdef MULTIPASS_RENDER
+    // If the window isn't open yet, the rays are computed by open().
+    if (is_open()) {
+        upload_rays();
+        fpShader_.detach(GL_FRAGMENT_SHADER | GL_VERTEX_SHADER);
+        if (!fpShader_.load(fpVbo_->getVertexLayout()->getDefaultFragShader(),
+                            fpVbo_->getVertexLayout()->getDefaultFPVertShader(bbox_str), config_.verbose_))
+            error_ = true;
+    }
+#endif
+}
+#endif
 
-        if (is_open()) {
-            fpShader_.detach(GL_FRAGMENT_SHADER | GL_VERTEX_SHADER);
-            if (!fpShader_.load(fpVbo_->getVertexLayout()->getDefaultFragShader(),
-                                fpVbo_->getVertexLayout()->getDefaultFPVertShader(bbox_str), config_.verbose_))
-                error_ = true;
+#ifdef MULTIPASS_RENDER
+// Fill fpVbo_ with the line segments drawn by the first render pass, one
+// for each ray computed by rayCalc_. Vertices are written directly into
+// the mapped vertex buffer, which is kept and refilled for the next shape.
+void
+Viewer::upload_rays()
+{
+    struct Vertex {
+        glm::vec3 pos;
+        glm::vec4 colour;
+    };
+    static_assert(sizeof(Vertex) == 7*sizeof(float),
+        "Vertex must match the vertex layout");
+    if (fpVbo_ == nullptr) {
+        std::vector<VertexLayout::VertexAttrib> attribs;
+        attribs.push_back({"position", 3, GL_FLOAT, POSITION_ATTRIBUTE, false, 0});
+        attribs.push_back({"color", 4, GL_FLOAT, COLOR_ATTRIBUTE, false, 0});
+        fpVbo_ = new Vbo(new VertexLayout(attribs), GL_LINES);
+    }
+#ifdef CALC_RAY
+    if (rayCalc_.isInit()) {
+        RayCalcRetCode res = rayCalc_.setParameters(tshape_);
+        if (res != RayCalcRetCode::OK) {
+            std::cout << "Error compiling OpenCL code." << std::endl;
+            die("Death because of error compiling OpenCL code.");
+        }
+        RayCalcResult result = rayCalc_.calculate(tshape_);
+        auto v = (Vertex*) fpVbo_->mapVertices(2 * result.rays.size());
+        if (v != nullptr) {
+            for (auto& r : result.rays) {
+                *v++ = {r.pos, r.colour};
+                *v++ = {r.pos + r.dir, r.colour};
+            }
         }
+        fpVbo_->unmapVertices();
+        return;
+    }
 #endif
+    fpVbo_->mapVertices(0);
 }
 #endif
 
@@ -217,6 +327,9 @@ void Viewer::open()
 
 void Viewer::reset_view(viewtype view )
 {
+    if (is_open())
+        view_changed();
+
     // Reset the 2D camera position.
     u_view2d_ = glm::mat3(1.);
 
@@ -294,6 +407,7 @@ bool Viewer::draw_frame()
     if (glfwWindowShouldClose(window_))
         return false;
     poll_events();
+    poll_pending_shape();
 
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
@@ -361,20 +475,52 @@ bool Viewer::draw_frame()
             ImGui::SameLine();
         }
         //ImGui::Checkbox("Power Saver", &config_.lazy_); // TODO: fix
+        if (ImGui::CollapsingHeader("GPU time (ms)")) {
+            ImGui::TextDisabled("pass       p50     p90     p99");
+            for (int p = 0; p < GPU_Timer::npasses; ++p) {
+                auto st = gpu_timer_.stats(GPU_Timer::Pass(p));
+                if (st.count == 0) continue;
+                ImGui::Text("%-8s %7.3f %7.3f %7.3f",
+                    GPU_Timer::pass_names[p], st.p50, st.p90, st.p99);
+            }
+        }
         ImGui::End();
         ImGui::PopStyleColor(1);
     }
 
+    double start = glfwGetTime();
     render();
     swap_buffers();
+    update_resolution(glfwGetTime() - start);
     if (!config_.lazy_)
         measure_time();
     return true;
 }
 
+void Viewer::render_offscreen(
+    double time, GLuint fbo, glm::ivec2 image_size, glm::ivec2 tile_offset)
+{
+    current_time_ = time;
+    offscreen_.fbo_ = fbo;
+    offscreen_.image_size_ = image_size;
+    offscreen_.tile_offset_ = tile_offset;
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, getWindowWidth(), getWindowHeight());
+    render();
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    offscreen_ = {};
+}
+
 void Viewer::close()
 {
     if (is_open()) {
+        // A shape whose shader is still compiling becomes the current shape,
+        // and is loaded by setup() when the window is reopened.
+        if (pending_) {
+            Viewed_Shape shape = std::move(pending_shape_);
+            cancel_pending_shape();
+            install_shape(std::move(shape));
+        }
         //glfwGetWindowPos(window_, &window_pos_.x, &window_pos_.y);
         glfwGetWindowSize(window_, &window_size_.x, &window_size_.y);
         onExit();
@@ -420,53 +566,8 @@ void Viewer::setup()
 
 
 #ifdef MULTIPASS_RENDER
-    if (fpVbo_ == nullptr) {
-// Gen mesh.
-        Mesh mesh;
-        //mesh.addVertex(glm::vec3(-1.0, -1.0, 1.0));
-        //mesh.addColor(glm::vec4(1.0, 0.3, 0.3, 1.0));
-        //mesh.addVertex(glm::vec3(1.0, -1.0, 1.0));
-        //mesh.addColor(glm::vec4(0.3, 0.3, 1.0, 1.0));
-        //mesh.addVertex(glm::vec3(1.0, 1.0, 1.0));
-        //mesh.addColor(glm::vec4(0.3, 1.0, 0.3, 1.0));
-        //mesh.addVertex(glm::vec3(-1.0, 1.0, 1.0));
-        //mesh.addColor(glm::vec4(1.0, 1.0, 1.0, 1.0));
-        //mesh.addIndex(0);   mesh.addIndex(1);   mesh.addIndex(3);
-        //mesh.addIndex(1);   mesh.addIndex(2);   mesh.addIndex(3);
-#ifdef CALC_RAY
-        if (rayCalc_.isInit())
-        {
-            //Input viewer uniforms.
-            //Input parameters.
-            RayCalcRetCode res = rayCalc_.setParameters(tshape_);
-            if (res != RayCalcRetCode::OK) {
-                std::cout << "Error compiling OpenCL code." << std::endl;
-                die("Death because of error compiling OpenCL code.");
-            }
-            //Input condition parameters.
-            //Calculate rays.
-            RayCalcResult result = rayCalc_.calculate(tshape_);
-            //Convert rays to lines.
-            //std::cout << "Drawing lines...." << std::endl;
-            mesh.setDrawMode(GL_LINES);
-            for (auto r : result.rays) {
-                //std::cout << "Line: (" << std::to_string(r.pos.x)
-                //          << ", " << std::to_string(r.pos.y)
-                //          << ", " << std::to_string(r.pos.z)
-                //          << ") -> (" << std::to_string((r.pos + r.dir).x)
-                //          << ", " << std::to_string((r.pos + r.dir).y)
-                //          << ", " << std::to_string((r.pos + r.dir).z)
-                //          << ")" << std::endl;
-                mesh.addVertex(r.pos);
-                mesh.addVertex(r.pos + r.dir);
-                mesh.addColor(r.colour);
-                mesh.addColor(r.colour);
-            }
-        }
-#endif
-
-        fpVbo_ = mesh.getVbo();
-    }
+    if (fpVbo_ == nullptr)
+        upload_rays();
     //Find bbox_min, bbox_max definition statements.
     std::string bbox_str;
     std::istringstream iss(shape_.frag_);
@@ -511,11 +612,13 @@ void Viewer::render()
 {
     unsigned cnt = num_errors_;
 
-    if (!error_) ImGui::Render();
+    if (!error_ && !headless_) ImGui::Render();
+    gpu_timer_.begin_frame();
 
 #ifdef MULTIPASS_RENDER
     if (!error_) {
 //First pass for drawing rays.
+        gpu_timer_.begin(GPU_Timer::rays);
 //Bind first pass buffers.
          glBindFramebuffer(GL_FRAMEBUFFER, fpFbo_);
         // Prepare viewport
@@ -540,12 +643,58 @@ void Viewer::render()
         fpShader_.setUniform("u_modelViewProjectionMatrix", mvp);
         fpVbo_->draw(&fpShader_);
 //Bind texture to second pass buffers.
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, offscreen_.fbo_);
+        gpu_timer_.end();
     }
 #endif
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    if (!error_) {
+    // While the view is moving, render with spatial AA disabled, and maybe
+    // at reduced resolution. Not used when rendering an exported image.
+    bool moving = !headless_ && view_moving();
+    dynres_.reduced_ = moving;
+    glm::ivec2 size{getWindowWidth(), getWindowHeight()};
+    bool scaled = moving && dynres_.scale_ < 1.0f;
+    glm::mat3 view2d = u_view2d_;
+    if (scaled) {
+        glm::ivec2 full = size;
+        size = glm::max(glm::ivec2(glm::vec2(full) * dynres_.scale_),
+                        glm::ivec2(1, 1));
+        bind_dynres_fbo(size);
+        glViewport(0, 0, size.x, size.y);
+        glClear(GL_COLOR_BUFFER_BIT);
+        // u_view2d_ maps window pixels to window pixels. Conjugate it by
+        // the resolution scale, so that it works in FBO pixels.
+        glm::vec2 s = glm::vec2(size) / glm::vec2(full);
+        glm::mat3 S = glm::scale(glm::mat3(1.), s);
+        glm::mat3 Sinv = glm::scale(glm::mat3(1.), 1.0f / s);
+        view2d = S * u_view2d_ * Sinv;
+    }
+
+    // While the view is static, accumulate AA samples over several frames.
+    bool accumulate = !moving && !error_ && accum_.aa_ > 1
+        && !accum_.animated_ && !headless_;
+    int nsamples = accum_.aa_ * accum_.aa_;
+    bool draw_shape = true;
+    if (accumulate) {
+        std::string state = accum_state();
+        if (state != accum_.state_) {
+            accum_.state_ = std::move(state);
+            accum_.samples_ = 0;
+        }
+        draw_shape = accum_.samples_ < nsamples;
+        if (draw_shape) {
+            // Blend the new sample into the running mean.
+            bind_accum_fbo(size);
+            glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+            glBlendColor(0, 0, 0, 1.0f / float(accum_.samples_ + 1));
+        }
+    } else {
+        accum_.samples_ = 0;
+    }
+
+    if (!error_ && draw_shape) {
+        gpu_timer_.begin(GPU_Timer::shape);
         shader_.use();
 #ifdef MULTIPASS_RENDER
         glActiveTexture(GL_TEXTURE0);
@@ -553,12 +702,37 @@ void Viewer::render()
         glUniform1i(glGetUniformLocation(shader_.getProgram(), "fp"), 0);
 #endif
         // Pass uniforms
-        shader_.setUniform("u_resolution", getWindowWidth(), getWindowHeight());
+        if (offscreen_.image_size_.x > 0) {
+            // Rendering one tile of a larger image.
+            shader_.setUniform("u_resolution",
+                float(offscreen_.image_size_.x),
+                float(offscreen_.image_size_.y));
+            shader_.setUniform("u_tile_offset",
+                float(offscreen_.tile_offset_.x),
+                float(offscreen_.tile_offset_.y));
+        } else {
+            shader_.setUniform("u_resolution", float(size.x), float(size.y));
+            shader_.setUniform("u_tile_offset", 0.0f, 0.0f);
+        }
+        // u_aa == 0 means the AA factor is the -Oaa option.
+        shader_.setUniform("u_aa", moving || accumulate ? 1 : 0);
+        if (accumulate) {
+            int k = accum_.samples_;
+            shader_.setUniform("u_jitter",
+                float(k % accum_.aa_) / accum_.aa_,
+                float(k / accum_.aa_) / accum_.aa_);
+        } else if (moving) {
+            // centre of pixel
+            shader_.setUniform("u_jitter", 0.5f, 0.5f);
+        } else {
+            shader_.setUniform("u_jitter", 0.0f, 0.0f);
+        }
+        shader_.setUniform("u_linear", int(accumulate));
         if (shader_.needTime()) {
             shader_.setUniform("u_time", float(current_time_));
         }
         if (shader_.needView2d()) {
-            shader_.setUniform("u_view2d", u_view2d_);
+            shader_.setUniform("u_view2d", view2d);
         }
         if (shader_.needView3d()) {
             shader_.setUniform("u_eye3d", u_eye3d_);
@@ -591,13 +765,158 @@ void Viewer::render()
         }
 
         vbo_->draw(&shader_);
+        gpu_timer_.end();
 
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        if (accumulate) {
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            glBindFramebuffer(GL_FRAMEBUFFER, offscreen_.fbo_);
+            ++accum_.samples_;
+        }
+        if (scaled) {
+            // Upscale to fill the window.
+            gpu_timer_.begin(GPU_Timer::resolve);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, dynres_.fbo_);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, offscreen_.fbo_);
+            glBlitFramebuffer(0, 0, size.x, size.y,
+                0, 0, getWindowWidth(), getWindowHeight(),
+                GL_COLOR_BUFFER_BIT, GL_LINEAR);
+            gpu_timer_.end();
+        }
+    }
+    if (!error_) {
+        if (accumulate) {
+            // Draw the mean of the accumulated samples.
+            gpu_timer_.begin(GPU_Timer::resolve);
+            accum_.resolve_.use();
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, accum_.tex_);
+            accum_.resolve_.setUniform("u_accum", 0);
+            accum_.resolve_.setUniform("u_modelViewProjectionMatrix",
+                glm::mat4(1.));
+            vbo_->draw(&accum_.resolve_);
+            gpu_timer_.end();
+        }
+
+        if (!headless_) {
+            gpu_timer_.begin(GPU_Timer::imgui);
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+            gpu_timer_.end();
+        }
+    }
+
+    if (scaled) {
+        glBindFramebuffer(GL_FRAMEBUFFER, offscreen_.fbo_);
+        glViewport(0, 0, getWindowWidth(), getWindowHeight());
     }
 
     if (num_errors_ > cnt) error_ = true;
 }
 
+// The state that determines the accumulated samples. When this changes,
+// accumulation starts over.
+std::string Viewer::accum_state()
+{
+    std::string state;
+    auto add = [&](const void* data, size_t size) {
+        state.append((const char*)data, size);
+    };
+    glm::ivec2 size{getWindowWidth(), getWindowHeight()};
+    GLuint program = shader_.getProgram();
+    add(&size, sizeof(size));
+    add(&program, sizeof(program));
+    add(&u_view2d_, sizeof(u_view2d_));
+    add(&u_eye3d_, sizeof(u_eye3d_));
+    add(&u_centre3d_, sizeof(u_centre3d_));
+    add(&u_up3d_, sizeof(u_up3d_));
+    for (auto& p : shape_.param_)
+        add(&p.second.pstate_, sizeof(p.second.pstate_));
+    return state;
+}
+
+// True if more samples remain to be accumulated.
+bool Viewer::accumulating()
+{
+    return accum_.samples_ > 0 && accum_.samples_ < accum_.aa_ * accum_.aa_;
+}
+
+void Viewer::bind_accum_fbo(glm::ivec2 size)
+{
+    if (accum_.fbo_ == 0) {
+        glGenTextures(1, &accum_.tex_);
+        glGenFramebuffers(1, &accum_.fbo_);
+        static const char resolve_frag[] =
+            "uniform sampler2D u_accum;\n"
+            "out vec4 oFragColour;\n"
+            "void main(void) {\n"
+            "    vec3 col = texelFetch(u_accum, ivec2(gl_FragCoord.xy), 0).rgb;\n"
+            "    // convert linear RGB to sRGB\n"
+            "    oFragColour = vec4(pow(col, vec3(0.454545454545454545)), 1.0);\n"
+            "}\n";
+        accum_.resolve_.load(resolve_frag, vertSource_, config_.verbose_);
+    }
+    if (size != accum_.size_) {
+        accum_.size_ = size;
+        glBindTexture(GL_TEXTURE_2D, accum_.tex_);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, size.x, size.y, 0,
+            GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, accum_.fbo_);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+            GL_TEXTURE_2D, accum_.tex_, 0);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, accum_.fbo_);
+}
+
+// Called when the camera moves.
+void Viewer::view_changed()
+{
+    dynres_.last_change_ = glfwGetTime();
+}
+
+// True if the view has changed recently enough that we should render
+// quickly rather than at full quality.
+bool Viewer::view_moving()
+{
+    constexpr double idle_time = 0.25; // seconds
+    return config_.ftarget_ > 0.0
+        && glfwGetTime() - dynres_.last_change_ < idle_time;
+}
+
+// Choose the resolution scale for the next frame that is rendered while the
+// view is moving, based on the time taken by the last frame.
+void Viewer::update_resolution(double frame_time)
+{
+    if (!dynres_.reduced_)
+        return;
+    constexpr float min_scale = 0.25;
+    // Rendering cost is proportional to the number of pixels, which is
+    // proportional to scale^2. Take half of that step, to damp oscillation.
+    double ratio = config_.ftarget_ / std::max(frame_time, 1e-4);
+    float scale = dynres_.scale_ * float(std::pow(ratio, 0.25));
+    dynres_.scale_ = std::min(std::max(scale, min_scale), 1.0f);
+}
+
+void Viewer::bind_dynres_fbo(glm::ivec2 size)
+{
+    if (dynres_.fbo_ == 0) {
+        glGenTextures(1, &dynres_.tex_);
+        glGenFramebuffers(1, &dynres_.fbo_);
+    }
+    if (size != dynres_.size_) {
+        dynres_.size_ = size;
+        glBindTexture(GL_TEXTURE_2D, dynres_.tex_);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.x, size.y, 0,
+            GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, dynres_.fbo_);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+            GL_TEXTURE_2D, dynres_.tex_, 0);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, dynres_.fbo_);
+}
+
 void Viewer::onKeyPress(int key, int mods)
 {
     bool ctrl = (mods & (GLFW_MOD_CONTROL|GLFW_MOD_SUPER)) != 0;
@@ -634,6 +953,7 @@ void Viewer::onScroll(float _yoffset)
     constexpr float zoomfactor = 1.1892;
     if (_yoffset != 0) {
         float z = pow(zoomfactor, _yoffset);
+        view_changed();
 
         // zoom view2d
         glm::vec2 zoom = glm::vec2(z,z);
@@ -650,6 +970,7 @@ void Viewer::onScroll(float _yoffset)
 
 void Viewer::onMouseDrag(float _x, float _y, int _button)
 {
+    view_changed();
     if (_button == 1){
         // Left-button drag is used to pan u_view2d_.
         u_view2d_ = glm::translate(u_view2d_, -mouse_.velocity);
@@ -699,6 +1020,7 @@ void Viewer::onExit()
     // DELETE RESOURCES
 #ifdef MULTIPASS_RENDER
     delete fpVbo_;
+    fpVbo_ = nullptr;
 #endif
     delete vbo_;
 }
@@ -787,6 +1109,13 @@ void Viewer::initGL()
         glDebugMessageCallback(MessageCallback, (void*)this);
     }
 
+    // Let the driver use as many threads as it likes to compile shaders
+    // in the background (see set_shape).
+    if (GLAD_GL_KHR_parallel_shader_compile)
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+
+    gpu_timer_.init();
+
     // The GL context is now set up and ready for use.
 
     glfwSwapInterval(1);
@@ -953,12 +1282,23 @@ void Viewer::measure_time()
             frame_time*1000.0,
             1.0/frame_time);
         glfwSetWindowTitle(window_, title);
+
+        if (config_.verbose_) {
+            gpu_timer_.write_json(std::cerr);
+            std::cerr << std::endl;
+        }
     }
 }
 
 void Viewer::poll_events()
 {
-    if (config_.lazy_)
+    if (config_.lazy_ && (pending_ || dynres_.reduced_ || accumulating())) {
+        // Wake up periodically to check if the pending shader is ready,
+        // to redraw at full quality once the view stops moving, or to
+        // accumulate the next AA sample.
+        glfwWaitEventsTimeout(0.01);
+    }
+    else if (config_.lazy_)
         glfwWaitEvents();
     else
         glfwPollEvents();
@@ -971,6 +1311,25 @@ void Viewer::swap_buffers()
 
 void Viewer::closeGL()
 {
+    if (dynres_.fbo_ != 0) {
+        glDeleteFramebuffers(1, &dynres_.fbo_);
+        glDeleteTextures(1, &dynres_.tex_);
+        dynres_.fbo_ = 0;
+        dynres_.tex_ = 0;
+        dynres_.size_ = glm::ivec2(0, 0);
+    }
+    dynres_.reduced_ = false;
+    if (accum_.fbo_ != 0) {
+        glDeleteFramebuffers(1, &accum_.fbo_);
+        glDeleteTextures(1, &accum_.tex_);
+        accum_.resolve_.unload();
+        accum_.fbo_ = 0;
+        accum_.tex_ = 0;
+        accum_.size_ = glm::ivec2(0, 0);
+    }
+    accum_.samples_ = 0;
+    accum_.state_.clear();
+    gpu_timer_.close();
 #ifdef MULTIPASS_RENDER
 //Delete textures?
 #endif
@@ -997,6 +1356,9 @@ void Viewer::setWindowSize(int _width, int _height)
 
 float Viewer::getPixelDensity()
 {
+    // A headless viewer renders into a framebuffer object whose size is
+    // exactly window_size_ pixels.
+    if (headless_) return 1.0;
     int window_width, window_height, framebuffer_width, framebuffer_height;
     glfwGetWindowSize(window_, &window_width, &window_height);
     glfwGetFramebufferSize(window_, &framebuffer_width, &framebuffer_height);
@@ -12,6 +12,7 @@
 
 #include <libcurv/render.h>
 #include <libcurv/viewed_shape.h>
+#include "gpu_timer.h"
 #include "shader.h"
 #include "vbo.h"
 #ifdef MULTIPASS_RENDER
@@ -65,6 +66,15 @@ struct Viewer
     // Close window. Idempotent.
     void close();
 
+    // Used for image export, with headless_ set and the window open.
+    // Render one frame at animation time `time` into the framebuffer object
+    // `fbo`, whose size is the window size. Returns without waiting for the
+    // GPU. To render a large image in tiles, the window size is the tile
+    // size, and `image_size` and `tile_offset` (in pixels, from the bottom
+    // left) give the tile's place in the image. Otherwise they are 0.
+    void render_offscreen(double time, GLuint fbo,
+        glm::ivec2 image_size = {0,0}, glm::ivec2 tile_offset = {0,0});
+
     ~Viewer();
 
     // Open a Viewer window on the current shape, and run until the window
@@ -92,7 +102,24 @@ struct Viewer
 #endif
     Viewed_Shape shape_{};
     Shader shader_{};
+    // A shape whose shader is being compiled in the background.
+    bool pending_ = false;
+    Viewed_Shape pending_shape_{};
+    Shader pending_shader_{};
+#ifdef CALC_RAY
+    // The rays to install with pending_shape_, if pending_rays_ is set,
+    // and the bounding box definitions for the ray pass shader.
+    bool pending_rays_ = false;
+    Traced_Shape pending_tshape_{};
+    std::string pending_bbox_{};
+#endif
     std::string vertSource_{};
+    // Set during render_offscreen().
+    struct {
+        GLuint fbo_ = 0;             // framebuffer that render() draws into
+        glm::ivec2 image_size_{0,0}; // size of the whole image, if tiled
+        glm::ivec2 tile_offset_{0,0};
+    } offscreen_;
     GLFWwindow* window_ = nullptr;
     bool have_window_pos_ = false;
     glm::ivec2 window_pos_;
@@ -110,9 +137,35 @@ struct Viewer
             frames_ = 0;
         }
     } fps_;
+    GPU_Timer gpu_timer_;
     GLuint vao_; // a Vertex Array Object
     bool hud_ = false;
     bool error_ = false;
+    // Adaptive resolution (see Render_Opts::ftarget_). While the view is
+    // moving, the shape is rendered into an FBO at a fraction of the window
+    // resolution, then scaled up to fill the window.
+    struct {
+        float scale_ = 1.0;          // resolution scale used while moving
+        double last_change_ = -1.0;  // time of the last view change
+        bool reduced_ = false;       // last frame was drawn at reduced quality
+        GLuint fbo_ = 0;
+        GLuint tex_ = 0;
+        glm::ivec2 size_{0, 0};
+    } dynres_;
+    // Accumulation anti-aliasing. While the view is static, one AA sample
+    // is rendered per frame into a float FBO, which holds the running mean
+    // of the samples, in linear RGB. Each frame, the mean is converted to
+    // sRGB and drawn to the window. Not used for animated shapes.
+    struct {
+        int aa_ = 1;                 // AA factor of the current shape
+        bool animated_ = false;      // the current shape depends on time
+        int samples_ = 0;            // # of samples in the FBO
+        std::string state_;          // view and parameters of those samples
+        GLuint fbo_ = 0;
+        GLuint tex_ = 0;
+        glm::ivec2 size_{0, 0};
+        Shader resolve_{};
+    } accum_;
     unsigned num_errors_ = 0;
 
     // The 2D camera position.
@@ -133,12 +186,28 @@ struct Viewer
 
     // INTERNAL FUNCTIONS
     void initGL();
+    void install_shape(Viewed_Shape);
+    void poll_pending_shape();
+    void cancel_pending_shape();
+#ifdef CALC_RAY
+    void install_rays(Traced_Shape, const std::string& bbox_str);
+#endif
     void setup();
     void onKeyPress(int, int);
     void onMouseMove(double, double);
     void onScroll(float);
     void onMouseDrag(float, float, int);
     void render();
+    void view_changed();
+    bool view_moving();
+    void update_resolution(double frame_time);
+    void bind_dynres_fbo(glm::ivec2 size);
+    std::string accum_state();
+    bool accumulating();
+    void bind_accum_fbo(glm::ivec2 size);
+#ifdef MULTIPASS_RENDER
+    void upload_rays();
+#endif
     void swap_buffers();
     void poll_events();
     void measure_time();
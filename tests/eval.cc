@@ -408,6 +408,20 @@ TEST(curv, eval)
     FAILMSG("for (42 in i) x", "not a pattern");
     SUCCESS("[for (i in [1,2,3]) i+1]", "[2,3,4]");
 
+    // append to a local variable
+    SUCCESS("do local a = [0]; for (i in 1..5) a := a ++ [i]; in a",
+        "[0,1,2,3,4,5]");
+    SUCCESS("do local a = [0]; local b = a; b := b ++ [1]; in [a,b]",
+        "[[0],[0,1]]");
+    SUCCESS("do local a = [0]; a := a ++ a; a := a ++ \"ab\"; in a",
+        "[0,0]++\"ab\"");
+    SUCCESS("do local a = []; a := a ++ \"ab\"; a := a ++ \"c\"; in a",
+        "\"abc\"");
+    SUCCESS("let a = [1,2,3] in [amend(a, 1, 0), a]", "[[1,0,3],[1,2,3]]");
+    SUCCESS("do local s = \"a\"; local t = s; for (i in 1..3) s := s ++ \"b\";"
+            "in [s, t, strcat[s,t], repr s]",
+        "[\"abbb\",\"a\",\"abbba\",\"\"_abbb\"_\"]");
+
     // generalized actions
     SUCCESS("do (let a=-2 in for(b in a..2) if(b>0) print b);"
             "   for(x in -1..1) if(x<0) print \"-\" else if(x>0) print \"+\";"
@@ -506,5 +520,14 @@ TEST(curv, eval)
 
     SUCCESS("{test print a; a = 1}", "{a:1}");
     EXPECT_EQ(sconsole.str(), "1\n");
+
+    // fields of a top level module are evaluated on first reference
+    SUCCESS("{a = 1; b = error \"b\"}.a", "1");
+    FAILMSG("{a = 1; b = error \"b\"}.b", "b");
+    SUCCESS("{a = do print \"a\" in 1; b = a + 1; c = b * 2}.c", "4");
+    EXPECT_EQ(sconsole.str(), "a\n");
+    SUCCESS("{f x = x + b; b = 2; [c,d] = [f 1, f 2]}", "{b:2,c:3,d:4,f:<function f>}");
+    SUCCESS("let m = {a = [1,2]; b = a ++ [3]} in m.b", "[1,2,3]");
+    FAILMSG("let m = {a = error \"a\"; b = a + 1} in m.b", "a");
   }
 }
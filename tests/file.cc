@@ -1,7 +1,13 @@
 #include <gtest/gtest.h>
 #undef FAIL
+#include <libcurv/context.h>
+#include <libcurv/exception.h>
+#include <libcurv/import.h>
+#include <libcurv/module.h>
 #include <libcurv/output_file.h>
 #include <sstream>
+#include <chrono>
+#include <filesystem>
 #include <fstream>
 #include <cstdio>
 #include "sys.h"
@@ -62,3 +68,111 @@ TEST(curv, output_file)
     ASSERT_EQ(readfile(p4), "foo");
     remove(",f4");
 }
+
+TEST(curv, import_cache)
+{
+    At_System cx{sys};
+    writefile(",i1.curv", "[1,2]");
+    writefile(",i2.curv", "file \",i1.curv\" ++ [3]");
+    Value v1 = curv_import(",i2.curv", cx);
+    ASSERT_EQ(stringify(v1)->c_str(), std::string("[1,2,3]"));
+
+    // An unchanged file is not re-evaluated.
+    Value v2 = curv_import(",i2.curv", cx);
+    ASSERT_EQ(&v1.to_ref_unsafe(), &v2.to_ref_unsafe());
+
+    // A change to a dependency is detected.
+    writefile(",i1.curv", "[1,2,4,5]");
+    Value v3 = curv_import(",i2.curv", cx);
+    ASSERT_EQ(stringify(v3)->c_str(), std::string("[1,2,4,5,3]"));
+
+    // Files imported while lazily evaluating a module field, after the
+    // import has returned, are also dependencies.
+    writefile(",i3.curv", "{a = file \",i1.curv\"}");
+    Value v4 = curv_import(",i3.curv", cx);
+    Symbol_Ref a = make_symbol("a");
+    ASSERT_EQ(stringify(v4.to<Module>(cx)->find_field(a, cx))->c_str(),
+        std::string("[1,2,4,5]"));
+    writefile(",i1.curv", "[6]");
+    Value v5 = curv_import(",i3.curv", cx);
+    ASSERT_NE(&v4.to_ref_unsafe(), &v5.to_ref_unsafe());
+    ASSERT_EQ(stringify(v5.to<Module>(cx)->find_field(a, cx))->c_str(),
+        std::string("[6]"));
+
+    // A change that preserves the size and (within the timestamp
+    // resolution) the mtime of a file is detected.
+    writefile(",i1.curv", "[7]");
+    curv_import(",i1.curv", cx);
+    writefile(",i1.curv", "[8]");
+    Value v7 = curv_import(",i1.curv", cx);
+    ASSERT_EQ(stringify(v7)->c_str(), std::string("[8]"));
+
+    remove(",i1.curv");
+    remove(",i2.curv");
+    remove(",i3.curv");
+}
+
+TEST(curv, file_stamp)
+{
+    // A file written just now is hashed, since it could be rewritten
+    // without changing its mtime or size.
+    writefile(",s1", "abc");
+    boost::system::error_code ec;
+    File_Stamp s1 = get_file_stamp(",s1", ec);
+    ASSERT_FALSE(ec);
+    ASSERT_TRUE(s1.hashed_);
+    ASSERT_TRUE(file_is_current(",s1", s1));
+    writefile(",s1", "abd");
+    ASSERT_FALSE(file_is_current(",s1", s1));
+
+    // An old file is not read, and a hashed stamp drops its hash once the
+    // mtime is old enough.
+    File_Stamp s2 = get_file_stamp(",s1", ec);
+    std::filesystem::last_write_time(",s1",
+        std::filesystem::last_write_time(",s1") - std::chrono::seconds(10));
+    File_Stamp s3 = get_file_stamp(",s1", ec);
+    ASSERT_FALSE(s3.hashed_);
+    ASSERT_FALSE(file_is_current(",s1", s2));
+    ASSERT_TRUE(file_is_current(",s1", s3));
+    s2 = s3;
+    s2.hashed_ = true;
+    s2.hash_ = std::hash<std::string>{}("abd");
+    ASSERT_TRUE(file_is_current(",s1", s2));
+    ASSERT_FALSE(s2.hashed_);
+
+    // A missing file is current if it was missing before.
+    remove(",s1");
+    File_Stamp s4 = get_file_stamp(",s1", ec);
+    ASSERT_TRUE(bool(ec));
+    ASSERT_TRUE(file_is_current(",s1", s4));
+    ASSERT_FALSE(file_is_current(",s1", s3));
+}
+
+TEST(curv, import_recursive_field)
+{
+    At_System cx{sys};
+
+    // A lazy field that imports its own file is a recursive reference,
+    // even though the field is forced after the import has returned.
+    writefile(",r1.curv", "{x = file \",r1.curv\"; y = 1}");
+    Value v = curv_import(",r1.curv", cx);
+    auto m = v.to<Module>(cx);
+    ASSERT_EQ(m->find_field(make_symbol("y"), cx).to_num(cx), 1.0);
+    try {
+        m->find_field(make_symbol("x"), cx);
+        GTEST_FAIL() << "expected an exception";
+    } catch (Exception& e) {
+        ASSERT_NE(std::string(e.what()).find(
+            "illegal recursive reference to file"), std::string::npos)
+            << e.what();
+    }
+
+    // A field referenced while its file is being evaluated is not.
+    writefile(",r2.curv", "{a = 2; test assert(a == 2)}");
+    Value v2 = curv_import(",r2.curv", cx);
+    ASSERT_EQ(v2.to<Module>(cx)->find_field(make_symbol("a"), cx)
+        .to_num(cx), 2.0);
+
+    remove(",r1.curv");
+    remove(",r2.curv");
+}
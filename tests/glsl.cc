@@ -0,0 +1,47 @@
+#include <gtest/gtest.h>
+#undef FAIL
+#include <libcurv/glsl.h>
+#include <libcurv/program.h>
+#include <libcurv/render.h>
+#include <libcurv/shape.h>
+#include <libcurv/source.h>
+#include <libcurv/viewed_shape.h>
+#include "sys.h"
+
+using namespace curv;
+
+// Compile a 3D shape with the given dist and colour functions, and test
+// if the frag shader depends on time.
+bool
+uses_time(const char* dist, const char* colour)
+{
+    std::string text = std::string("{is_2d: false, is_3d: true, ")
+        + "bbox: [[-1,-1,-1],[1,1,1]], "
+        + "dist: " + dist + ", colour: " + colour + "}";
+    auto source = make<String_Source>("", text);
+    Program prog{std::move(source), sys};
+    prog.compile();
+    Value value = prog.eval();
+    Render_Opts opts;
+    Shape_Program shape{prog};
+    EXPECT_TRUE(shape.recognize(value, &opts));
+    Viewed_Shape vshape(shape, opts);
+    return glsl_uses_time(vshape.frag_);
+}
+
+TEST(curv, glsl_uses_time)
+{
+    const char* red = "[x,y,z,t] -> [1,0,0]";
+
+    // Time is unpacked from the argument, but not used.
+    EXPECT_FALSE(uses_time("[x,y,z,t] -> x*x + y*y + z*z - 1", red));
+    // Time is repacked into a vector, as a transformation does.
+    EXPECT_FALSE(uses_time(
+        "[x,y,z,t] -> let q = [y,x,z,t] in q[0]*q[1]*q[2] - 1", red));
+
+    EXPECT_TRUE(uses_time("[x,y,z,t] -> x*x + y*y + z*z - 1 + sin t", red));
+    EXPECT_TRUE(uses_time(
+        "[x,y,z,t] -> let q = [y,x,z,t] in q[0]*q[1]*q[2] - q[3]", red));
+    EXPECT_TRUE(uses_time(
+        "[x,y,z,t] -> x*x + y*y + z*z - 1", "[x,y,z,t] -> [sin t,0,0]"));
+}
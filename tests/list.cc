@@ -24,3 +24,33 @@ TEST(curv, list)
     x = nullptr;
     ASSERT_EQ(y->use_count, 1u);
 }
+
+TEST(curv, list_append)
+{
+    // Moving a Shared leaves the target with the only reference.
+    Shared<List> a = List::make({Value{0.0}});
+    Shared<List> b = std::move(a);
+    ASSERT_EQ(a, nullptr);
+    ASSERT_EQ(b->use_count, 1u);
+
+    // The first append reallocates with spare capacity; the next one
+    // extends the list in place.
+    auto one = List::make({Value{1.0}});
+    List_Base::append(b, *one);
+    ASSERT_EQ(b->size(), 2u);
+    ASSERT_EQ(b->capacity(), 2u);
+    List_Base::append(b, *one);
+    ASSERT_EQ(b->capacity(), 4u);
+    const Value* data = &(*b)[0];
+    List_Base::append(b, *one);
+    ASSERT_EQ(&(*b)[0], data);
+    ASSERT_EQ(b->size(), 4u);
+    ASSERT_TRUE((*b)[3].eq(Value{1.0}));
+
+    // A shared list is copied, and the other reference is unchanged.
+    Shared<List> c = b;
+    List_Base::append(c, *one);
+    ASSERT_NE(&(*c)[0], data);
+    ASSERT_EQ(b->size(), 4u);
+    ASSERT_EQ(c->size(), 5u);
+}
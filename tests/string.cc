@@ -24,6 +24,35 @@ TEST(curv, string)
     auto s1 = stringify("sqrt(2)==",sqrt(2));
     ASSERT_STREQ(s1->c_str(), "sqrt(2)==1.4142135623730951");
 
+    // String_Builder hands over its buffer; later writes don't affect it.
+    String_Builder sb;
+    for (int i = 0; i < 1000; ++i)
+        sb << "ab";
+    auto s2 = sb.get_string();
+    ASSERT_EQ(s2->size(), 2000u);
+    ASSERT_EQ(s2->c_str()[2000], '\0');
+    sb << 'c';
+    ASSERT_EQ(s2->size(), 2000u);
+    ASSERT_EQ(sb.str().size(), 2001u);
+    ASSERT_EQ(sb.get_string()->size(), 2001u);
+
+    // Appending to a uniquely referenced string is done in place,
+    // once the capacity has grown.
+    Shared<String> s3 = make_string("foo");
+    String_Base::append(s3, "bar", 3);
+    String_Base::append(s3, "baz", 3);
+    ASSERT_STREQ(s3->c_str(), "foobarbaz");
+    ASSERT_GE(s3->capacity(), 12u);
+    auto p3 = s3.get();
+    String_Base::append(s3, "!", 1);
+    ASSERT_EQ(s3.get(), p3);
+    ASSERT_STREQ(s3->c_str(), "foobarbaz!");
+    Shared<String> s4 = s3;
+    String_Base::append(s4, "?", 1);
+    ASSERT_NE(s4.get(), s3.get());
+    ASSERT_STREQ(s3->c_str(), "foobarbaz!");
+    ASSERT_STREQ(s4->c_str(), "foobarbaz!?");
+
     Symbol_Ref a0 = make_symbol("foo");
     auto sym0 = a0.to_value().maybe<Symbol>();
     ASSERT_EQ(sym0->type_, Ref_Value::ty_symbol);